@@ -0,0 +1,257 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <time.h>
+#include <sys/time.h>
+#include "sim.h"
+#include "simd.h"
+#include "pool.h"
+using namespace std;
+
+//simulation throughput with a player in the middle of a crowd of zeds,
+//run with no arguments for the standard sizes or give zed counts, both at
+//full rate everywhere. -jN runs the zed update on N threads.
+//"bench boxes" checks the batched box tests against the scalar ones and times them,
+//"bench grid" compares the two broadphases with zeds packed close together,
+//"bench lod" runs the zeds at full rate everywhere and then with the default
+//level of detail bands,
+//"bench pickups" walks a needy player over every cell holding use
+
+const int WARMUP_TICKS=60;
+const int BENCH_TICKS=1200;
+
+//the pickup caches take a few hundred slots, so the biggest crowd that fits
+//is well under MAX_ZEDS
+const int BIG_CROWD=3584;
+
+const int FULL_RATE[Game::LOD_BANDS]={32,32,32,32};
+
+//zeds spread over a square of cells in the middle of the map
+void setupWorld(int nzeds, int cells=30){
+    Game::seed(1);
+    Game::initServer();
+    Game::respawnPlayer(0);
+    srand(1);
+    const float lo=(32-cells)/2*16.0f+1.0f;
+    const float size=cells*16.0f-2.0f;
+    for(int n=0;n<nzeds;n++){
+        const float x=lo+(float)rand()/RAND_MAX*size;
+        const float z=lo+(float)rand()/RAND_MAX*size;
+        if(Game::spawnZed(x,z,(float)rand()/RAND_MAX*M_PI*2)==-1)
+            break;
+    }
+}
+
+void benchZeds(int nzeds, int cells=30){
+    setupWorld(nzeds,cells);
+    int live=0;
+    for(int i=0;i<Game::MAX_ZEDS;i++)
+        if(Game::zed.state[i]==Game::Z_WANDERING)
+            live++;
+    for(int i=0;i<WARMUP_TICKS;i++)
+        Game::step(Game::TIMESTEP);
+
+    //wall time, clock() adds up every thread
+    timeval start,end;
+    gettimeofday(&start,NULL);
+    for(int i=0;i<BENCH_TICKS;i++)
+        Game::step(Game::TIMESTEP);
+    gettimeofday(&end,NULL);
+    const double secs=(end.tv_sec-start.tv_sec)+(end.tv_usec-start.tv_usec)/1e6;
+
+    cout<<"zeds: "<<live;
+    if(live<nzeds)
+        cout<<" (of "<<nzeds<<", out of slots)";
+    cout<<" ticks/s: "<<(int)(BENCH_TICKS/(secs>0?secs:1e-9))
+        <<" us/tick: "<<secs*1e6/BENCH_TICKS<<"\n";
+}
+
+void benchGrid(){
+    const int sizes[2]={1024,3072};
+    for(int i=0;i<2;i++)
+        for(int grid=0;grid<2;grid++){
+            Game::setSortedGrid(grid!=0);
+            cout<<(grid?"sorted grid ":"cell lists  ");
+            benchZeds(sizes[i],6);
+        }
+    Game::setSortedGrid(false);
+}
+
+void benchLod(){
+    const int bands[Game::LOD_BANDS]={2,4,8,12};
+    const int sizes[2]={1024,BIG_CROWD};
+    for(int i=0;i<2;i++){
+        Game::setLodBands(FULL_RATE);
+        cout<<"full rate ";
+        benchZeds(sizes[i]);
+        Game::setLodBands(bands);
+        int counts[Game::LOD_BANDS+1],updates,fullupdates;
+        Game::getLodStats(counts,&updates,&fullupdates);
+        const int u0=updates,f0=fullupdates;
+        cout<<"lod bands ";
+        benchZeds(sizes[i]);
+        Game::getLodStats(counts,&updates,&fullupdates);
+        cout<<"  zeds by band:";
+        for(int b=0;b<=Game::LOD_BANDS;b++)
+            cout<<" "<<counts[b];
+        cout<<" (last is asleep), updates run: "
+            <<100.0*(updates-u0)/max(fullupdates-f0,1)<<"%\n";
+    }
+}
+
+void benchPickups(){
+    setupWorld(1024);
+    int queries,scanned,taken=0;
+    Game::getPickupStats(&queries,&scanned);
+    const int q0=queries,s0=scanned;
+    for(int iz=1;iz<31;iz++)
+    for(int ix=1;ix<31;ix++){
+        const int before=Game::zed.count;
+        Game::pl[0].p.set(ix*16.0f+8.0f,0.0f,iz*16.0f+8.0f);
+        Game::pl[0].health=1;
+        Game::pl[0].ammo=0;
+        Game::pl[0].keys=Game::KB_USE;
+        Game::step(Game::TIMESTEP);
+        taken+=before-Game::zed.count;
+    }
+    Game::getPickupStats(&queries,&scanned);
+    cout<<"pickups: "<<taken<<" taken in "<<queries-q0<<" queries, "
+        <<(float)(scanned-s0)/(queries-q0)<<" looked at per query, "
+        <<Game::zed.count<<" live zeds\n";
+}
+
+const int BOX_QUERIES=200000;
+
+float frand(float lo, float hi){
+    return lo+(float)rand()/RAND_MAX*(hi-lo);
+}
+
+//zed sized boxes scattered around the origin, close enough that about half
+//the queries hit something
+void randomBoxes(Game::Boxes &b, int n){
+    b.n=n;
+    for(int j=0;j<n;j++){
+        const float r=frand(0.0f,M_PI*2);
+        b.px[j]=frand(-3.0f,3.0f);
+        b.py[j]=frand(0.0f,3.0f);
+        b.pz[j]=frand(-3.0f,3.0f);
+        b.c[j]=cosf(r);
+        b.s[j]=sinf(r);
+        b.ex[j]=frand(0.3f,1.4f);
+        b.ey[j]=frand(0.3f,1.4f);
+        b.ez[j]=frand(0.3f,1.4f);
+        b.id[j]=j;
+    }
+}
+
+void randomOBB(Game::OBB &a){
+    a=Game::OBB(Game::vect(frand(-4.0f,4.0f),frand(-1.0f,4.0f),frand(-4.0f,4.0f)),
+        Game::vect(frand(0.2f,1.0f),frand(0.2f,1.0f),frand(0.2f,1.0f)));
+    a.rotatex(frand(0.0f,M_PI*2));
+    a.rotatey(frand(0.0f,M_PI*2));
+    a.rotatez(frand(0.0f,M_PI*2));
+}
+
+int benchBoxes(){
+    const int SETS=256;
+    Game::Boxes *sets=new Game::Boxes[SETS];
+    float (*segs)[6]=new float[SETS][6];
+    Game::OBB *obbs=new Game::OBB[SETS];
+    srand(1);
+    for(int i=0;i<SETS;i++){
+        randomBoxes(sets[i],1+rand()%Game::BOX_BATCH);
+        for(int k=0;k<6;k++)
+            segs[i][k]=frand(-5.0f,5.0f);
+        segs[i][1]+=1.5f;
+        segs[i][4]=segs[i][1]+frand(-1.0f,1.0f);
+        randomOBB(obbs[i]);
+    }
+
+    //exactness, every query must pick the same box as the scalar path
+    int wrong=0,hits=0;
+    for(int q=0;q<BOX_QUERIES;q++){
+        const int i=q%SETS;
+        if(q%SETS==0 && q>0)
+            for(int k=0;k<SETS;k++){
+                randomBoxes(sets[k],1+rand()%Game::BOX_BATCH);
+                randomOBB(obbs[k]);
+            }
+        const int s0=Game::segmentVsBoxesScalar(&segs[i][0],&segs[i][3],sets[i]);
+        const int s1=Game::segmentVsBoxes(&segs[i][0],&segs[i][3],sets[i]);
+        const int o0=Game::obbVsBoxesScalar(obbs[i],sets[i]);
+        const int o1=Game::obbVsBoxes(obbs[i],sets[i]);
+        if(s0!=s1 || o0!=o1)
+            wrong++;
+        if(s0!=-1) hits++;
+        if(o0!=-1) hits++;
+    }
+    cout<<"box tests: "<<BOX_QUERIES*2<<" queries, "<<hits<<" hits, "<<wrong<<" mismatches\n";
+
+    //time full scans so early outs don't hide the per box cost
+    for(int i=0;i<SETS;i++){
+        randomBoxes(sets[i],Game::BOX_BATCH);
+        for(int j=0;j<Game::BOX_BATCH;j++)
+            sets[i].py[j]+=100.0f;
+    }
+    int found=0;
+    clock_t start=clock();
+    for(int q=0;q<BOX_QUERIES;q++)
+        found+=Game::segmentVsBoxesScalar(&segs[q%SETS][0],&segs[q%SETS][3],sets[q%SETS]);
+    const double segscalar=(double)(clock()-start)/CLOCKS_PER_SEC;
+    start=clock();
+    for(int q=0;q<BOX_QUERIES;q++)
+        found+=Game::segmentVsBoxes(&segs[q%SETS][0],&segs[q%SETS][3],sets[q%SETS]);
+    const double segbatch=(double)(clock()-start)/CLOCKS_PER_SEC;
+    start=clock();
+    for(int q=0;q<BOX_QUERIES;q++)
+        found+=Game::obbVsBoxesScalar(obbs[q%SETS],sets[q%SETS]);
+    const double obbscalar=(double)(clock()-start)/CLOCKS_PER_SEC;
+    start=clock();
+    for(int q=0;q<BOX_QUERIES;q++)
+        found+=Game::obbVsBoxes(obbs[q%SETS],sets[q%SETS]);
+    const double obbbatch=(double)(clock()-start)/CLOCKS_PER_SEC;
+
+    const double n=(double)BOX_QUERIES*Game::BOX_BATCH/1e9;
+    cout<<"segment vs box: scalar "<<segscalar/n<<"ns batched "<<segbatch/n<<"ns\n"
+        <<"obb vs box: scalar "<<obbscalar/n<<"ns batched "<<obbbatch/n<<"ns"
+        <<(found==-4*BOX_QUERIES?"":" (unexpected hit)")<<"\n";
+
+    delete[] sets;
+    delete[] segs;
+    delete[] obbs;
+    return wrong?1:0;
+}
+
+int main(int argc, char** argv){
+    int arg=1;
+    if(argc>arg && !strncmp(argv[arg],"-j",2))
+        Game::setThreads(atoi(argv[arg++]+2));
+    cout<<"kernels: "<<Game::simdName()<<" threads: "<<Game::getWorkerCount()<<"\n";
+    if(argc>arg && !strcmp(argv[arg],"boxes"))
+        return benchBoxes();
+    if(argc>arg && !strcmp(argv[arg],"grid")){
+        benchGrid();
+        return 0;
+    }
+    if(argc>arg && !strcmp(argv[arg],"lod")){
+        benchLod();
+        return 0;
+    }
+    if(argc>arg && !strcmp(argv[arg],"pickups")){
+        benchPickups();
+        return 0;
+    }
+    Game::setLodBands(FULL_RATE);
+    cout<<"lod: full rate\n";
+    if(argc>arg){
+        for(int i=arg;i<argc;i++)
+            benchZeds(atoi(argv[i]));
+    }else{
+        const int sizes[3]={256,1024,BIG_CROWD};
+        for(int i=0;i<3;i++)
+            benchZeds(sizes[i]);
+    }
+    Game::closeWorkers();
+    return 0;
+}
@@ -1,79 +1,165 @@
 #include <SDL/SDL_net.h>
 #include <iostream>
+#include <algorithm>
+#include <stdlib.h>
 #include "game.h"
 #include "net.h"
 using namespace std;
 using namespace Net;
 
 const int DEFAULT_PORT=8080;
+const int CONNECT_INTERVAL=200; //ms between connect retries
+const int CHUNK_INTERVAL=100; //ms before asking again for missing chunks
 
 UDPsocket udpsock=NULL;
 
 int connectstatus=0;
-bool downloadedMapPart[4]={};
+Uint32 connectstart=0;
+Uint32 lastrequest=0;
+bool requestnow=false; //progress was made, don't wait for the retry timer
+bool haveinfo=false;
+bool haveworld=false;
+bool cached=false; //map was rebuilt from the seed
+int worldbytes=0; //received during the handshake
+Uint32 worldhash=0;
+int worldsize=0;
+int worldchunks=0;
+int chunkbase=0; //every chunk before this one is held
+unsigned char *world=NULL;
+bool *havechunk=NULL;
+Uint32 recvseq=0; //newest snapshot datagram applied
+Uint32 recvmask=0; //bit n set if recvseq-n was applied
+//last fields received per zed, snapshots only carry the ones that changed
+unsigned short zedfields[Game::MAX_ZEDS][4];
+unsigned char zedstate[Game::MAX_ZEDS];
 
 int sendClientUpdate(){
     if(!udpsock)
         return -1;
-    UDPpacket *p=SDLNet_AllocPacket(6);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
-        return -1;
-    }
 
-    unsigned char keys;
-    unsigned short aimr,aimp;
-    if(Game::getClientUpdate(&keys,&aimr,&aimp))
+    Game::Input inputs[MAX_UPDATE_INPUTS];
+    const int n=Game::getClientInputs(&inputs[0],MAX_UPDATE_INPUTS);
+    if(n<0)
         return 0;
 
-    p->len=6;
-    p->data[0]=P_UPDATE;
-    p->data[1]=keys;
-    SDLNet_Write16(aimr,&p->data[2]);
-    SDLNet_Write16(aimp,&p->data[4]);
-
-    if(!SDLNet_UDP_Send(udpsock,0,p)){
-        cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
+
+    p->len=UPDATE_HEADER+n*UPDATE_INPUT;
+    p->data[0]=P_UPDATE;
+    SDLNet_Write32(recvseq,&p->data[1]);
+    SDLNet_Write32(recvmask,&p->data[5]);
+    p->data[9]=n;
+    unsigned char *d=&p->data[UPDATE_HEADER];
+    for(int j=0;j<n;j++,d+=UPDATE_INPUT){
+        SDLNet_Write32(inputs[j].seq,&d[0]);
+        d[4]=inputs[j].keys;
+        SDLNet_Write16(inputs[j].aimr,&d[5]);
+        SDLNet_Write16(inputs[j].aimp,&d[7]);
+        d[9]=inputs[j].msec;
     }
-    SDLNet_FreePacket(p);
-    p=NULL;
-    return 0;
+
+    const int ret=sendPacket(udpsock,0,p);
+    releasePacket(p);
+    return ret;
 }
 
 int sendConnectRequest(){
     if(!udpsock)
         return -1;
-    UDPpacket *p=SDLNet_AllocPacket(2);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
-    bool waiting=false;
-    for(int part=0;part<4;part++)
-        if(!downloadedMapPart[part]){
-            waiting=true;
-            p->len=2;
-            p->data[0]=P_GETWORLD;
-            p->data[1]=part;
-            if(!SDLNet_UDP_Send(udpsock,0,p)){
-                cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
-                return -1;
-            }
-        }
-    if(!waiting){
+    if(!haveinfo){
+        p->len=1;
+        p->data[0]=P_GETWORLD;
+    }else if(!haveworld){
+        while(chunkbase<worldchunks && havechunk[chunkbase])
+            chunkbase++;
+        Uint32 mask=0;
+        for(int n=0;n<WORLD_WINDOW && chunkbase+n<worldchunks;n++)
+            if(havechunk[chunkbase+n])
+                mask|=(Uint32)1<<n;
+        p->len=GETCHUNKS_SIZE;
+        p->data[0]=P_GETCHUNKS;
+        SDLNet_Write16(chunkbase,&p->data[1]);
+        SDLNet_Write32(mask,&p->data[3]);
+    }else{
         p->len=1;
         p->data[0]=P_GETCLIENTINFO;
-        if(!SDLNet_UDP_Send(udpsock,0,p)){
-            cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
-            return -1;
-        }
     }
+    const int ret=sendPacket(udpsock,0,p);
+    lastrequest=SDL_GetTicks();
+    requestnow=false;
 
-    SDLNet_FreePacket(p);
-    p=NULL;
-    return 0;
+    releasePacket(p);
+    return ret;
+}
+
+void receiveWorldInfo(const UDPpacket *p){
+    int w,h;
+    Game::getMapSize(&w,&h);
+    if(SDLNet_Read16(&p->data[1])!=w || SDLNet_Read16(&p->data[3])!=h){
+        cout<<"server map is "<<SDLNet_Read16(&p->data[1])<<"x"<<SDLNet_Read16(&p->data[3])
+            <<", expected "<<w<<"x"<<h<<"\n";
+        return;
+    }
+    worldhash=SDLNet_Read32(&p->data[9]);
+    haveinfo=true;
+    requestnow=true;
+
+    Game::generateMap(SDLNet_Read32(&p->data[5]));
+    if(Game::hashMap()==worldhash){
+        haveworld=cached=true;
+        return;
+    }
+
+    worldsize=SDLNet_Read32(&p->data[13]);
+    if(worldsize<1 || worldsize>packedMapBound(w*h)){
+        haveinfo=false;
+        return;
+    }
+    worldchunks=(worldsize+WORLD_CHUNK-1)/WORLD_CHUNK;
+    chunkbase=0;
+    world=new unsigned char[worldsize];
+    havechunk=new bool[worldchunks];
+    for(int i=0;i<worldchunks;i++)
+        havechunk[i]=false;
+}
+
+void receiveChunk(const UDPpacket *p){
+    const int chunk=SDLNet_Read16(&p->data[1]);
+    if(chunk<0 || chunk>=worldchunks || havechunk[chunk])
+        return;
+    const int start=chunk*WORLD_CHUNK;
+    const int len=min(WORLD_CHUNK,worldsize-start);
+    if(p->len!=WORLD_HEADER+len)
+        return;
+    for(int i=0;i<len;i++)
+        world[start+i]=p->data[WORLD_HEADER+i];
+    havechunk[chunk]=true;
+
+    //ask for the next window as soon as this one is complete
+    int n=chunkbase;
+    while(n<worldchunks && havechunk[n])
+        n++;
+    if(n==worldchunks || n>=chunkbase+WORLD_WINDOW)
+        requestnow=true;
+    if(n<worldchunks)
+        return;
+
+    int w,h;
+    Game::getMapSize(&w,&h);
+    if(unpackMap(world,worldsize,Game::getMap(),w*h) || Game::hashMap()!=worldhash){
+        cout<<"bad world data, downloading again\n";
+        for(int i=0;i<worldchunks;i++)
+            havechunk[i]=false;
+        chunkbase=0;
+        return;
+    }
+    haveworld=true;
 }
 
 int initClient(const char* hostname, int port){
@@ -85,6 +171,8 @@ int initClient(const char* hostname, int port){
         cout<<"SDLNet_Init: "<<SDLNet_GetError()<<"\n";
         return -1;
     }
+    if(initPool())
+        return -1;
 
     udpsock=SDLNet_UDP_Open(0);
     if(!udpsock){
@@ -102,14 +190,20 @@ int initClient(const char* hostname, int port){
         return -1;
     }
 
+    connectstart=SDL_GetTicks();
     sendConnectRequest();
 
     return 0;
 }
 
 void closeClient(){
+    delete[] world;
+    world=NULL;
+    delete[] havechunk;
+    havechunk=NULL;
     SDLNet_UDP_Close(udpsock);
     udpsock=NULL;
+    closePool();
     SDLNet_Quit();
     SDL_Quit();
 }
@@ -118,37 +212,89 @@ void processPacket(UDPpacket *p){
     if(p->len<1)
         return;
     switch(p->data[0]){
-    case P_WORLD: {
-        if(p->len<258)
-            break;
-        unsigned char *map=Game::getMap();
-        if(!map)
+    case P_WORLDINFO:
+        if(p->len<WORLDINFO_SIZE)
             break;
-        int start=p->data[1]*256;
-        if(start>32*32-256)
+        worldbytes+=p->len;
+        if(!haveinfo)
+            receiveWorldInfo(p);
+        break;
+    case P_WORLD:
+        if(p->len<WORLD_HEADER)
             break;
-        for(int i=0;i<256;i++)
-            map[start+i]=p->data[i+2];
-        downloadedMapPart[p->data[1]]=true;
-        } break;
+        worldbytes+=p->len;
+        if(haveinfo && !haveworld)
+            receiveChunk(p);
+        break;
     case P_CLIENTINFO:
-        if(p->len<2)
+        if(p->len<CLIENTINFO_SIZE)
             break;
-        Game::setClientID(p->data[1]);
+        if(!haveworld || connectstatus)
+            break;
+        if(Game::setClientID(p->data[1])==-1){
+            cout<<"bad client id "<<(int)p->data[1]<<"\n";
+            break;
+        }
+        Game::setTickRate(SDLNet_Read16(&p->data[2]));
         connectstatus=1;
+        cout<<"connected in "<<SDL_GetTicks()-connectstart<<"ms, world "
+            <<(cached?"built from seed":"downloaded")<<", "<<worldbytes<<" bytes received\n";
         break;
-    case P_PLAYERUPDATE: {
-        if(p->len<21)
+    case P_SNAPSHOT: {
+        if(p->len<SNAPSHOT_HEADER)
             break;
-        int i=p->data[1];
-        unsigned char kha[3];
-        unsigned short pv[8];
-        kha[0]=p->data[2];
-        kha[1]=p->data[3];
-        kha[2]=p->data[4];
-        for(int j=0;j<8;j++)
-            pv[j]=SDLNet_Read16(&p->data[5+j*2]);
-        Game::setPlayerUpdate(i,&pv[0],&kha[0]);
+        const Uint32 tick=SDLNet_Read32(&p->data[1]);
+        const Uint32 seq=SDLNet_Read32(&p->data[5]);
+        const Uint32 ackinput=SDLNet_Read32(&p->data[9]);
+        const int n=p->data[13];
+        const int nzeds=SDLNet_Read16(&p->data[14]);
+        if(p->len<SNAPSHOT_HEADER+n*SNAPSHOT_PLAYER+nzeds*SNAPSHOT_ZED)
+            break;
+        //drop duplicates and stale datagrams that arrived out of order,
+        //they stay unacked so the server resends whatever they carried
+        const Sint32 ds=(Sint32)(seq-recvseq);
+        if(ds<=0)
+            break;
+        recvmask=ds<32?(recvmask<<ds)|1:1;
+        recvseq=seq;
+        Game::serverTick(tick);
+        const unsigned char *d=&p->data[SNAPSHOT_HEADER];
+        bool own=false;
+        for(int j=0;j<n;j++,d+=SNAPSHOT_PLAYER){
+            unsigned char kha[3];
+            unsigned short pv[8];
+            kha[0]=d[1];
+            kha[1]=d[2];
+            kha[2]=d[3];
+            for(int k=0;k<8;k++)
+                pv[k]=SDLNet_Read16(&d[4+k*2]);
+            Game::setPlayerUpdate(d[0],&pv[0],&kha[0]);
+            if(d[0]==Game::getClientID())
+                own=true;
+            else
+                Game::bufferPlayer(d[0],tick);
+        }
+        //server state is behind our prediction, replay what it hasn't seen
+        if(own)
+            Game::reconcile(ackinput);
+        const unsigned char *end=&p->data[p->len];
+        for(int j=0;j<nzeds && end-d>=SNAPSHOT_ZED;j++){
+            const int z=SDLNet_Read16(&d[0]);
+            const unsigned char fields=d[2];
+            d+=SNAPSHOT_ZED;
+            if(z>=Game::MAX_ZEDS || end-d<zedFieldBytes(fields))
+                break;
+            if(fields&ZED_STATE)
+                zedstate[z]=*d++;
+            if(zedstate[z]==Game::Z_NONE)
+                zedfields[z][0]=zedfields[z][1]=zedfields[z][2]=zedfields[z][3]=0;
+            for(int k=0;k<4;k++)
+                if(fields&(1<<k)){
+                    zedfields[z][k]=SDLNet_Read16(d);
+                    d+=2;
+                }
+            Game::setZedUpdate(z,zedfields[z],zedstate[z]);
+        }
         } break;
     default:
         break;
@@ -156,22 +302,20 @@ void processPacket(UDPpacket *p){
 }
 
 int updateClient(){
-    UDPpacket *p=SDLNet_AllocPacket(1024);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
     while(SDLNet_UDP_Recv(udpsock,p)>0){
         processPacket(p);
     }
 
-    SDLNet_FreePacket(p);
-    p=NULL;
+    releasePacket(p);
 
     if(connectstatus==0){
-        SDL_Delay(200);
-        sendConnectRequest();
+        const Uint32 interval=haveinfo && !haveworld?CHUNK_INTERVAL:CONNECT_INTERVAL;
+        if(requestnow || SDL_GetTicks()-lastrequest>=interval)
+            sendConnectRequest();
     }else{
         sendClientUpdate();
     }
@@ -179,10 +323,13 @@ int updateClient(){
     return 0;
 }
 
-int main(){
-    if(initClient("localhost",DEFAULT_PORT))
+int main(int argc, char** argv){
+    const char *host=argc>1?argv[1]:"localhost";
+    if(initClient(host,DEFAULT_PORT))
         return 0;
     Game::initClient();
+    if(argc>2)
+        Game::setInterpDelay(atoi(argv[2])/1000.0f);
 
     for(;;){
         if(updateClient())
@@ -1,7 +1,12 @@
 #include <SDL/SDL.h>
 #include <SDL/SDL_opengl.h>
 #include <iostream>
+#include <vector>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/time.h>
 #include "MersenneTwister.h"
 //#include "SOIL.h"
 #include "game.h"
@@ -18,7 +23,6 @@ namespace Game{
     const int CENTER_X=WINDOW_W/2;
     const int CENTER_Y=WINDOW_H/2;
 
-    bool isserver=false;
     bool sdl_started=false;
     int gamestate=0;
 
@@ -26,339 +30,590 @@ namespace Game{
     bool isKeyPressed[SDLK_LAST];
     bool isKeyDown[SDLK_LAST];
 
-    struct vect{
-        float x,y,z;
-        inline vect():x(0.0f),y(0.0f),z(0.0f){}
-        inline vect(const float _x, const float _y, const float _z):x(_x),y(_y),z(_z){}
-        inline vect& set(const vect& v){ x=v.x; y=v.y; z=v.z; return *this; }
-        inline vect& set(const float _x,const float _y,const float _z){x=_x;y=_y;z=_z;return *this;}
-        inline vect& add(const vect& v){ x+=v.x; y+=v.y; z+=v.z; return *this; }
-        inline vect& sub(const vect& v){ x-=v.x; y-=v.y; z-=v.z; return *this; }
-        inline vect& add(const float _x,const float _y,const float _z){x+=_x;y+=_y;z+=_z;return *this;}
-        inline vect& adds(const vect& v, const float s){ x+=v.x*s; y+=v.y*s; z+=v.z*s; return *this; }
-        inline vect& cross(const vect& v){
-            const float ox=x,oy=y; x=oy*v.z-z*v.y; y=z*v.x-ox*v.z; z=ox*v.y-oy*v.x; return *this; }
-        inline vect& normalize(){
-            float d=x*x+y*y+z*z; if(d>0){ d=1.0f/sqrtf(d); x*=d; y*=d; z*=d; } return *this; }
-    };
-    inline float dot(const vect& v, const vect& w){ return v.x*w.x+v.y*w.y+v.z*w.z; }
-    inline float len(const vect& v){ return sqrtf(v.x*v.x+v.y*v.y+v.z*v.z); }
-
-    struct OBB{
-        vect ax,ay,az; //orthonormal basis
-        vect p,e; //center position, extents
-        inline OBB():ax(1.0f,0.0f,0.0f),ay(0.0f,1.0f,0.0f),az(0.0f,0.0f,1.0f){}
-        inline OBB(const vect& _p, const vect& _e)
-            :ax(1.0f,0.0f,0.0f),ay(0.0f,1.0f,0.0f),az(0.0f,0.0f,1.0f),p(_p),e(_e){}
-        void rotatex(const float r){
-            const float co=cosf(r); const float si=sinf(r); vect by,bz;
-            by.adds(ay,co).adds(az,si); bz.adds(ay,-si).adds(az,co); ay.set(by); az.set(bz); }
-        void rotatey(const float r){
-            const float co=cosf(r); const float si=sinf(r); vect bx,bz;
-            bx.adds(az,-si).adds(ax,co); bz.adds(az,co).adds(ax,si); ax.set(bx); az.set(bz); }
-        void rotatez(const float r){
-            const float co=cosf(r); const float si=sinf(r); vect bx,by;
-            bx.adds(ax,co).adds(ay,si); by.adds(ax,-si).adds(ay,co); ax.set(bx); ay.set(by); }
-        void translate(const vect& v){ p.adds(ax,v.x).adds(ay,v.y).adds(az,v.z); }
-        void ltow(vect& v)const{ vect r; r.adds(ax,v.x).adds(ay,v.y).adds(az,v.z).add(p); v.set(r); }
-        void wtol(vect& v)const{ v.sub(p); v.set(dot(ax,v),dot(ay,v),dot(az,v)); }
-    };
-
     int frames=0;
-    int plid=-1; //local player id
+    const double FRAME_REPORT=10.0; //seconds between frame time reports
+    double reportstart=0;
+    int reportframes=0;
+    int reportticks=0;
     vect cam;
     vect look;
     float sensitivity=0.0010f;
+    MTRand hudrng;
     char healthhud[400];
-
-    MTRand rng;
-    char *map=NULL;
-    int *cols=NULL;
-    const char INSIDE_BIT=0x01;
-    const char DOORX_BIT=0x02;
-    const char DOORZ_BIT=0x04;
-
-    const int MAX_PLAYERS=8;
-    const int MAX_ZEDS=4096;
-    const int MAX_BULLETS=64;
-    const int MAX_PARTICLES=1024;
-    const unsigned char Z_NONE=0;
-    const unsigned char Z_DEAD=1;
-    const unsigned char Z_WANDERING=3; //wandering about
-    const unsigned char Z_ATTACKING=4; //running at players
-    const unsigned char Z_HEALTH=10; //pickup
-    const unsigned char Z_AMMO=11; //pickup
-
-    struct Player{
-        vect p;
-        vect v;
+    int hudhealth=-1;
+
+    //local inputs kept until the server confirms it has applied them
+    const int INPUT_RING=64;
+    Input inputs[INPUT_RING];
+    unsigned int inputseq=0; //newest input
+    unsigned int ackedinput=0; //newest input the server has applied
+    unsigned int sentinput=0; //newest input handed out for an update
+
+    //remote players are drawn interpdelay behind the newest snapshot,
+    //between the two buffered server states around that time
+    const int SAMPLES=32;
+    struct Sample{
+        unsigned int tick;
+        vect p,v;
         float lookr,lookp;
-        float shootdelay;
-        int health,ammo;
-        bool onground;
         unsigned char keys;
-        unsigned char state;
-    }pl[MAX_PLAYERS];
-
-    struct Zed{
-        vect p;
-        vect v;
-        float rot;
-        int ix,iz;
-        int cnext,cprev;
-        unsigned char state;
-    }zed[MAX_ZEDS];
-
-    struct Bullet{
-        vect p;
-        vect v;
-    }bullets[MAX_BULLETS];
-
-    struct Particle{
-        vect p;
-        float age;
-    }particles[MAX_PARTICLES];
-
-    enum {
-        KB_LEFT=1,
-        KB_RIGHT=2,
-        KB_FORWARD=4,
-        KB_BACK=8,
-        KB_JUMP=16,
-        KB_USE=32,
-        KB_FIRE=64
-    };
-
-    void setKeys(int i, unsigned char keys){
-        if(pl[i].state)
-            pl[i].keys=keys;
-    }
-
-    void setAim(int i, unsigned short aimr, unsigned short aimp){
-        if(pl[i].state){
-            pl[i].lookr=(float)aimr*M_PI*2.0f/65536.0f;
-            pl[i].lookp=(float)aimp*M_PI/65536.0f-M_PI*0.5f;
-            if(pl[i].lookr>M_PI*2) pl[i].lookr-=M_PI*2;
-            if(pl[i].lookr<0) pl[i].lookr+=M_PI*2;
-            if(pl[i].lookp>0.49f*M_PI) pl[i].lookp=0.49f*M_PI;
-            if(pl[i].lookp<-0.49f*M_PI) pl[i].lookp=-0.49f*M_PI;
-        }
+    }samples[MAX_PLAYERS][SAMPLES];
+    unsigned int nsamples[MAX_PLAYERS];
+    int tickrate=60;
+    double servertick=-1; //estimate of the newest tick the server has sent
+    float interpdelay=0.1f;
+
+    //the simulation runs in fixed ticks of 1/tickrate whatever the frame
+    //rate, frames are drawn blend of the way from the state before the last
+    //tick to the state after it
+    double lastframe=-1;
+    double tickclock=0; //seconds not yet simulated
+    float blend=1.0f;
+    float inputms=0; //part of a ms not yet handed out to an input
+    bool usequeued=false; //use was pressed since the last tick
+    int ticks=0;
+    //anything that moved further between two ticks than a zed of the slowest
+    //band walks in one update, with room for a push out, jumped there and is
+    //drawn where it is
+    float blendsnap=ZED_SPEED*MAX_PACE*1.5f*TIMESTEP;
+    //the own player is updated every tick, so it snaps past what it can
+    //cover in one, a respawn or a big correction
+    float camsnap=PL_SPEED*1.5f*TIMESTEP;
+    vect prevown;
+    float prevzx[MAX_ZEDS],prevzy[MAX_ZEDS],prevzz[MAX_ZEDS],prevrot[MAX_ZEDS];
+
+    //ZED_FPS=n paces frames to n a second, ZED_VSYNC=off stops the swap
+    //waiting for the display so that with no cap frames run flat out
+    double framecap=0; //seconds per frame, 0 for none
+    double framedue=0;
+
+    //SDL_GetTicks only counts whole ms
+    double clockSeconds(){
+        timeval tv;
+        gettimeofday(&tv,NULL);
+        return tv.tv_sec+tv.tv_usec/1e6;
     }
 
-    void setClientID(int id){
+    int setClientID(int id){
+        if(id<0 || id>=MAX_PLAYERS)
+            return -1;
         plid=id;
-        if(plid<0 || plid>=MAX_PLAYERS)
-            plid=-1;
         gamestate=1;
         pl[plid].state=1;
+        return 0;
     }
 
-    unsigned short getAimr(int i){
-        return (unsigned short)(pl[i].lookr*65536.0f/(M_PI*2.0f));
+    int getClientID(){
+        return plid;
     }
 
-    unsigned short getAimp(int i){
-        return (unsigned short)((pl[i].lookp+M_PI*0.5f)*65536.0f/M_PI);
+    //newest unacked inputs, oldest first. everything made since the last
+    //call and at least UPDATE_INPUTS to cover losses
+    int getClientInputs(Input *in, int limit){
+        if(plid==-1)
+            return -1;
+        int n=min((int)(inputseq-ackedinput),limit);
+        n=min(n,max((int)(inputseq-sentinput),Net::UPDATE_INPUTS));
+        sentinput=inputseq;
+        for(int i=0;i<n;i++)
+            in[i]=inputs[(inputseq-n+1+i)%INPUT_RING];
+        return n;
     }
 
-    unsigned char* getMap(){
-        return (unsigned char*)map;
+    void setTickRate(int rate){
+        if(rate>0)
+            tickrate=rate;
+        blendsnap=ZED_SPEED*MAX_PACE*1.5f/tickrate;
+        camsnap=PL_SPEED*1.5f/tickrate;
     }
 
-    int getClientUpdate(unsigned char *keys, unsigned short *aimr, unsigned short *aimp){
-        if(plid==-1)
-            return -1;
-        *keys=pl[plid].keys;
-        *aimr=getAimr(plid);
-        *aimp=getAimp(plid);
-        return 0;
+    void setInterpDelay(float delay){
+        if(delay>=0)
+            interpdelay=delay;
     }
 
-    void updateHealthHud(){
-        if(plid!=-1){
-            const float r=(float)pl[plid].health/100.0f;
-            for(int i=0;i<400;i++)
-                healthhud[i]=rng()<r?1:0;
-        }
+    //keep our clock in step with the snapshot stream, small drift is eased out
+    void serverTick(unsigned int tick){
+        if(servertick<0 || fabs(servertick-tick)>tickrate*0.25f)
+            servertick=tick;
+        else
+            servertick+=(tick-servertick)*0.1;
     }
 
-    int getPlayerUpdate(int i, unsigned short *pv, unsigned char* kha){
-        if(i<0 || i>=MAX_PLAYERS || pl[i].state==0)
-            return -1;
-        pv[0]=(unsigned short)(pl[i].p.x*65536.0f/512.0f);
-        pv[1]=(unsigned short)(pl[i].p.y*65536.0f/512.0f);
-        pv[2]=(unsigned short)(pl[i].p.z*65536.0f/512.0f);
-        pv[3]=(signed short)(pl[i].v.x*4.0f);
-        pv[4]=(signed short)(pl[i].v.y*4.0f);
-        pv[5]=(signed short)(pl[i].v.z*4.0f);
-        pv[6]=getAimr(i);
-        pv[7]=getAimp(i);
-        kha[0]=pl[i].keys;
-        kha[1]=(signed char)pl[i].health;
-        kha[2]=(signed char)pl[i].ammo;
-        return 0;
+    void bufferPlayer(int i, unsigned int tick){
+        if(i<0 || i>=MAX_PLAYERS)
+            return;
+        if(nsamples[i]>0 && (int)(tick-samples[i][(nsamples[i]-1)%SAMPLES].tick)<=0)
+            return;
+        Sample &s=samples[i][nsamples[i]%SAMPLES];
+        s.tick=tick;
+        s.p.set(pl[i].p);
+        s.v.set(pl[i].v);
+        s.lookr=pl[i].lookr;
+        s.lookp=pl[i].lookp;
+        s.keys=pl[i].keys;
+        nsamples[i]++;
     }
 
-    int setPlayerUpdate(int i, const unsigned short *pv, const unsigned char* kha){
-        if(i<0 || i>=MAX_PLAYERS)
-            return -1;
-        pl[i].p.set(
-        ((float)pv[0])*512.0f/65536.0f,
-        ((float)pv[1])*512.0f/65536.0f,
-        ((float)pv[2])*512.0f/65536.0f);
-        pl[i].v.set(
-        ((float)((signed short)pv[3]))/4.0f,
-        ((float)((signed short)pv[4]))/4.0f,
-        ((float)((signed short)pv[5]))/4.0f);
-        if(i!=plid){
-            setAim(i,pv[6],pv[7]);
-            pl[i].keys=kha[0];
-        }
-        pl[i].health=(signed char)kha[1];
-        pl[i].ammo=(signed char)kha[2];
-        pl[i].state=1;
-        if(i==plid)
-            updateHealthHud();
-        return 0;
+    void applySample(int i, const Sample &s){
+        pl[i].p.set(s.p);
+        pl[i].v.set(s.v);
+        pl[i].lookr=s.lookr;
+        pl[i].lookp=s.lookp;
+        pl[i].keys=s.keys;
     }
 
-    void respawnPlayer(int p){
-        pl[p].p.set(248.0f,0.0f,248.0f);
-        pl[p].v.set(0.0f,0.0f,0.0f);
-        pl[p].lookr=0.0f;
-        pl[p].lookp=0.0f;
-        pl[p].shootdelay=0.5f;
-        pl[p].health=100;
-        pl[p].ammo=30;
-        pl[p].onground=true;
-        pl[p].keys=0;
-        pl[p].state=1;
-        if(p==plid){
-            cam.set(pl[p].p);
-            cam.y+=2.5f;
-            look.set(0.0f,0.0f,0.0f);
-            updateHealthHud();
+    void interpolatePlayer(int i, double rendertick){
+        const unsigned int n=nsamples[i];
+        if(n==0)
+            return;
+        const int avail=min(n,(unsigned int)SAMPLES);
+        for(int k=0;k<avail;k++){
+            const Sample &a=samples[i][(n-1-k)%SAMPLES];
+            if(a.tick>rendertick)
+                continue;
+            //past the newest state, hold it until the next one arrives
+            if(k==0){
+                applySample(i,a);
+                return;
+            }
+            const Sample &b=samples[i][(n-k)%SAMPLES];
+            const float f=(float)((rendertick-a.tick)/(b.tick-a.tick));
+            float dr=b.lookr-a.lookr;
+            if(dr>M_PI) dr-=M_PI*2;
+            if(dr<-M_PI) dr+=M_PI*2;
+            pl[i].p.set(a.p).adds(b.p,f).adds(a.p,-f);
+            pl[i].v.set(b.v);
+            pl[i].lookr=a.lookr+dr*f;
+            pl[i].lookp=a.lookp+(b.lookp-a.lookp)*f;
+            pl[i].keys=b.keys;
+            return;
         }
+        applySample(i,samples[i][(n-avail)%SAMPLES]);
     }
 
-    void removePlayer(int p){
-        pl[p].p.set(0.0f,0.0f,0.0f);
-        pl[p].v.set(0.0f,0.0f,0.0f);
-        pl[p].keys=0;
-        pl[p].state=0;
+    //the server leaves out players we can't see and players that left, so
+    //one missing from the snapshots for a while is dropped until it shows up
+    //again
+    const float PLAYER_EXPIRE=0.5f; //seconds
+    bool expirePlayer(int i){
+        const unsigned int n=nsamples[i];
+        if(n>0 && servertick-samples[i][(n-1)%SAMPLES].tick<PLAYER_EXPIRE*tickrate)
+            return false;
+        pl[i].state=0;
+        nsamples[i]=0;
+        return true;
     }
 
-    int initServer(){
-        isserver=true;
+    void reconcile(unsigned int ackinput){
+        if(plid==-1 || (int)(ackinput-ackedinput)<0)
+            return;
+        ackedinput=ackinput;
+        //inputs that fell off the ring are lost, replay what we still have
+        unsigned int seq=ackinput+1;
+        if((int)(inputseq-seq)>=INPUT_RING)
+            seq=inputseq-INPUT_RING+1;
+        for(;(int)(inputseq-seq)>=0;seq++)
+            movePlayer(plid,inputs[seq%INPUT_RING]);
+    }
 
-        //game vars
-        frames=0;
+    //buffers are from gl 1.5 and shaders from 2.0, looked up at run time
+    typedef void (APIENTRY *GenBuffersFn)(GLsizei n, GLuint *buffers);
+    typedef void (APIENTRY *BindBufferFn)(GLenum target, GLuint buffer);
+    typedef void (APIENTRY *BufferDataFn)(GLenum target, ptrdiff_t size, const GLvoid *data, GLenum usage);
+    typedef GLuint (APIENTRY *CreateShaderFn)(GLenum type);
+    typedef void (APIENTRY *ShaderSourceFn)(GLuint shader, GLsizei n, const char **src, const GLint *len);
+    typedef void (APIENTRY *CompileShaderFn)(GLuint shader);
+    typedef void (APIENTRY *GetShaderivFn)(GLuint shader, GLenum name, GLint *param);
+    typedef void (APIENTRY *GetShaderInfoLogFn)(GLuint shader, GLsizei max, GLsizei *len, char *log);
+    typedef GLuint (APIENTRY *CreateProgramFn)();
+    typedef void (APIENTRY *AttachShaderFn)(GLuint program, GLuint shader);
+    typedef void (APIENTRY *BindAttribLocationFn)(GLuint program, GLuint index, const char *name);
+    typedef void (APIENTRY *LinkProgramFn)(GLuint program);
+    typedef void (APIENTRY *GetProgramivFn)(GLuint program, GLenum name, GLint *param);
+    typedef void (APIENTRY *UseProgramFn)(GLuint program);
+    typedef void (APIENTRY *VertexAttribPointerFn)(GLuint index, GLint size, GLenum type,
+        GLboolean normalized, GLsizei stride, const GLvoid *p);
+    typedef void (APIENTRY *VertexAttribArrayFn)(GLuint index);
+    typedef void (APIENTRY *VertexAttribDivisorFn)(GLuint index, GLuint divisor);
+    typedef void (APIENTRY *DrawElementsInstancedFn)(GLenum mode, GLsizei count, GLenum type,
+        const GLvoid *indices, GLsizei instances);
+    GenBuffersFn genBuffers=NULL;
+    BindBufferFn bindBuffer=NULL;
+    BufferDataFn bufferData=NULL;
+    CreateShaderFn createShader=NULL;
+    ShaderSourceFn shaderSource=NULL;
+    CompileShaderFn compileShader=NULL;
+    GetShaderivFn getShaderiv=NULL;
+    GetShaderInfoLogFn getShaderInfoLog=NULL;
+    CreateProgramFn createProgram=NULL;
+    AttachShaderFn attachShader=NULL;
+    BindAttribLocationFn bindAttribLocation=NULL;
+    LinkProgramFn linkProgram=NULL;
+    GetProgramivFn getProgramiv=NULL;
+    UseProgramFn useProgram=NULL;
+    VertexAttribPointerFn vertexAttribPointer=NULL;
+    VertexAttribArrayFn enableVertexAttribArray=NULL;
+    VertexAttribArrayFn disableVertexAttribArray=NULL;
+    VertexAttribDivisorFn vertexAttribDivisor=NULL;
+    DrawElementsInstancedFn drawElementsInstanced=NULL;
+    bool havebuffers=false;
+    bool haveinstancing=false;
+#ifndef GL_ARRAY_BUFFER_ARB
+#define GL_ARRAY_BUFFER_ARB 0x8892
+#endif
+#ifndef GL_ELEMENT_ARRAY_BUFFER_ARB
+#define GL_ELEMENT_ARRAY_BUFFER_ARB 0x8893
+#endif
+#ifndef GL_STREAM_DRAW_ARB
+#define GL_STREAM_DRAW_ARB 0x88E0
+#endif
+#ifndef GL_STATIC_DRAW_ARB
+#define GL_STATIC_DRAW_ARB 0x88E4
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+    bool hasExtension(const char *name){
+        const char *ext=(const char*)glGetString(GL_EXTENSIONS);
+        if(!ext)
+            return false;
+        const size_t len=strlen(name);
+        for(const char *s=strstr(ext,name);s;s=strstr(s+len,name))
+            if((s==ext || s[-1]==' ') && (s[len]==' ' || s[len]==0))
+                return true;
+        return false;
+    }
 
-        if(map) delete[] map;
-        map=new char[32*32];
-        if(cols) delete[] cols;
-        cols=new int[32*32];
-        //clear
-        for(int i=0;i<32*32;i++)
-            map[i]=0;
-        for(int i=0;i<32*32;i++)
-            cols[i]=-1;
-        for(int i=0;i<MAX_ZEDS;i++)
-            zed[i].state=Z_NONE;
-        //buildings
-        for(int c=3;c>0;--c){
-            for(int iy=1;iy<31;iy++)
-            for(int ix=1;ix<31;ix++){
-                if(iy!=13 && ix!=13 && rng.randInt(1)){
-                    const int i=iy*32+ix;
-                    if(map[i-32]&&map[i+32] || map[i-1]&&map[i+1]
-                        || map[i-33]&&!map[i-32]&&!map[i-1]
-                        || map[i-31]&&!map[i-32]&&!map[i+1]
-                        || map[i+31]&&!map[i+32]&&!map[i-1]
-                        || map[i+33]&&!map[i+32]&&!map[i+1])
-                        continue;
-                    map[i]=INSIDE_BIT;
-                }
-            }
+    void* glProc(const char *name){
+        return SDL_GL_GetProcAddress(name);
+    }
+
+    void loadExtensions(){
+        havebuffers=haveinstancing=false;
+        if(hasExtension("GL_ARB_vertex_buffer_object")){
+            genBuffers=(GenBuffersFn)glProc("glGenBuffersARB");
+            bindBuffer=(BindBufferFn)glProc("glBindBufferARB");
+            bufferData=(BufferDataFn)glProc("glBufferDataARB");
+            havebuffers=genBuffers && bindBuffer && bufferData;
         }
-        //doorways
-        for(int iy=1;iy<31;iy++)
-        for(int ix=1;ix<31;ix++){
-            const int i=iy*32+ix;
-            if(map[i]&INSIDE_BIT){
-                switch(rng.randInt(3)){
-                case 0: map[i]|=DOORX_BIT; break;
-                case 1: map[i]|=DOORZ_BIT; break;
-                case 2: map[i-1]|=DOORX_BIT; break;
-                case 3: map[i-32]|=DOORZ_BIT; break;
-                }
-                if(rng.rand()<0.20)
-                    switch(rng.randInt(3)){
-                    case 0: map[i]|=DOORX_BIT; break;
-                    case 1: map[i]|=DOORZ_BIT; break;
-                    case 2: map[i-1]|=DOORX_BIT; break;
-                    case 3: map[i-32]|=DOORZ_BIT; break;
-                    }
+        const char *version=(const char*)glGetString(GL_VERSION);
+        if(!havebuffers || !version || atoi(version)<2
+            || !hasExtension("GL_ARB_instanced_arrays") || !hasExtension("GL_ARB_draw_instanced"))
+            return;
+        createShader=(CreateShaderFn)glProc("glCreateShader");
+        shaderSource=(ShaderSourceFn)glProc("glShaderSource");
+        compileShader=(CompileShaderFn)glProc("glCompileShader");
+        getShaderiv=(GetShaderivFn)glProc("glGetShaderiv");
+        getShaderInfoLog=(GetShaderInfoLogFn)glProc("glGetShaderInfoLog");
+        createProgram=(CreateProgramFn)glProc("glCreateProgram");
+        attachShader=(AttachShaderFn)glProc("glAttachShader");
+        bindAttribLocation=(BindAttribLocationFn)glProc("glBindAttribLocation");
+        linkProgram=(LinkProgramFn)glProc("glLinkProgram");
+        getProgramiv=(GetProgramivFn)glProc("glGetProgramiv");
+        useProgram=(UseProgramFn)glProc("glUseProgram");
+        vertexAttribPointer=(VertexAttribPointerFn)glProc("glVertexAttribPointer");
+        enableVertexAttribArray=(VertexAttribArrayFn)glProc("glEnableVertexAttribArray");
+        disableVertexAttribArray=(VertexAttribArrayFn)glProc("glDisableVertexAttribArray");
+        vertexAttribDivisor=(VertexAttribDivisorFn)glProc("glVertexAttribDivisorARB");
+        drawElementsInstanced=(DrawElementsInstancedFn)glProc("glDrawElementsInstancedARB");
+        haveinstancing=createShader && shaderSource && compileShader && getShaderiv
+            && getShaderInfoLog && createProgram && attachShader && bindAttribLocation
+            && linkProgram && getProgramiv && useProgram && vertexAttribPointer
+            && enableVertexAttribArray && disableVertexAttribArray
+            && vertexAttribDivisor && drawElementsInstanced;
+    }
+
+    //the city only changes with the map, so it is baked once into arrays of
+    //quads split into indexed triangles and drawn from vertex buffers, or a
+    //display list where those are missing. ZED_CITY=list or immediate caps
+    //the choice, for comparing against drawing the array vertex by vertex
+    //every frame
+    enum{CITY_IMMEDIATE,CITY_LIST,CITY_VBO};
+    const char *citynames[3]={"immediate","list","vbo"};
+    struct CityVertex{
+        GLshort x,y,z,w;
+        GLubyte r,g,b,a;
+    };
+    vector<CityVertex> city;
+    vector<GLushort> cityidx; //a full map is under 8000 quads, 4 vertices each
+    vector<GLushort> cityvis; //indices of the cells drawn this frame
+    const int CITY_BORDER=32*32; //the high walls round the map, after the cells
+    int cityfirst[CITY_BORDER+1],citycount[CITY_BORDER+1]; //in indices
+    GLubyte citycol=0;
+    int citymode=CITY_IMMEDIATE;
+    GLuint citybuf=0; //vertex buffer or display list
+    GLuint cityidxbuf=0;
+    bool citybaked=false;
+    bool cullon=true; //ZED_CULL=off draws every cell, for comparing
+    unsigned int cityhash=0; //map the city was baked from
+
+    void pickCityMode(){
+        const char *cap=getenv("ZED_CITY");
+        citymode=havebuffers?CITY_VBO:CITY_LIST;
+        if(cap && !strcmp(cap,"list"))
+            citymode=CITY_LIST;
+        if(cap && !strcmp(cap,"immediate"))
+            citymode=CITY_IMMEDIATE;
+        cap=getenv("ZED_CULL");
+        cullon=!(cap && !strcmp(cap,"off"));
+    }
+
+    //zeds, pickups and other players are one mesh per kind, placed by a
+    //position and a turn. with shaders and instanced arrays each kind is one
+    //instanced draw, otherwise every instance is transformed here into one
+    //streaming buffer drawn in one call. ZED_ENTITIES=stream or immediate
+    //caps the choice, immediate pushes a matrix per instance
+    enum{ENT_ZED,ENT_DEAD,ENT_HEALTH,ENT_AMMO,ENT_PLAYER,ENT_KINDS};
+    enum{ENT_IMMEDIATE,ENT_STREAM,ENT_INSTANCED};
+    const char *entnames[3]={"immediate","stream","instanced"};
+    const float entcols[ENT_KINDS]={0.35f,0.35f,0.76f,0.76f,0.55f};
+    const int MAX_INSTANCES=MAX_ZEDS+MAX_PLAYERS;
+    struct EntityVertex{
+        float x,y,z;
+        GLubyte r,g,b,a;
+    };
+    int entmode=ENT_IMMEDIATE;
+    vector<float> meshes; //vertices of every kind, x y z
+    vector<GLushort> meshidx; //triangles, indexing meshes
+    int meshfirst[ENT_KINDS],meshcount[ENT_KINDS]; //in vertices
+    int idxfirst[ENT_KINDS],idxcount[ENT_KINDS];
+    int meshstart=0; //first vertex of the kind being built
+    float insts[MAX_INSTANCES*4]; //x y z turn, grouped by kind
+    int instfirst[ENT_KINDS],instcount[ENT_KINDS];
+    vector<EntityVertex> entverts;
+    vector<GLuint> entidx;
+    GLuint meshbuf=0,meshidxbuf=0,instbuf=0,entbuf=0,entidxbuf=0;
+    GLuint entprog=0;
+    vector<float> partverts; //x y z, four corners per particle
+    GLuint partbuf=0;
+    const GLuint INST_ATTRIB=1;
+
+    //turns by inst.w around y, as glRotatef(-w) did
+    const char *entshader=
+        "#version 110\n"
+        "attribute vec4 inst;\n"
+        "void main(){\n"
+        "    float c=cos(inst.w);\n"
+        "    float s=sin(inst.w);\n"
+        "    vec4 p=vec4(gl_Vertex.x*c-gl_Vertex.z*s+inst.x,gl_Vertex.y+inst.y,\n"
+        "        gl_Vertex.x*s+gl_Vertex.z*c+inst.z,1.0);\n"
+        "    vec4 e=gl_ModelViewMatrix*p;\n"
+        "    gl_Position=gl_ProjectionMatrix*e;\n"
+        "    gl_FrontColor=gl_Color;\n"
+        "    gl_FogFragCoord=abs(e.z);\n"
+        "}\n";
+
+    const float ZEDW=0.80f;
+    const float ZEDW2=0.565685425f;
+    const float PICKUPW=0.30f;
+    const float zedstrip[]={
+        +ZEDW,0.0f,0.0f, +ZEDW,2.8f,0.0f,
+        0.0f,0.0f,+ZEDW, 0.0f,2.8f,+ZEDW,
+        -ZEDW,0.0f,0.0f, -ZEDW,2.8f,0.0f,
+        0.0f,0.0f,-ZEDW, 0.0f,2.8f,-ZEDW,
+        +ZEDW,0.0f,0.0f, +ZEDW,2.8f,0.0f};
+    const float zedcaps[]={
+        +ZEDW,0.0f,0.0f, 0.0f,0.0f,+ZEDW,
+        -ZEDW,0.0f,0.0f, 0.0f,0.0f,-ZEDW,
+        +ZEDW,2.8f,0.0f, 0.0f,2.8f,+ZEDW,
+        -ZEDW,2.8f,0.0f, 0.0f,2.8f,-ZEDW};
+    const float deadstrip[]={
+        -1.4f,0.0f,+ZEDW2, +1.4f,0.0f,+ZEDW2,
+        -1.4f,ZEDW2*2,+ZEDW2, +1.4f,ZEDW2*2,+ZEDW2,
+        -1.4f,ZEDW2*2,-ZEDW2, +1.4f,ZEDW2*2,-ZEDW2,
+        -1.4f,0.0f,-ZEDW2, +1.4f,0.0f,-ZEDW2,
+        -1.4f,0.0f,+ZEDW2, +1.4f,0.0f,+ZEDW2};
+    const float deadcaps[]={
+        -1.4f,0.0f,+ZEDW2, -1.4f,ZEDW2*2,+ZEDW2,
+        -1.4f,ZEDW2*2,-ZEDW2, -1.4f,0.0f,-ZEDW2,
+        +1.4f,0.0f,+ZEDW2, +1.4f,ZEDW2*2,+ZEDW2,
+        +1.4f,ZEDW2*2,-ZEDW2, +1.4f,0.0f,-ZEDW2};
+    const float healthfaces[]={
+        -0.5f,0.0f,+0.5f, +0.5f,0.0f,+0.5f,
+        +0.5f,1.0f,+0.5f, -0.5f,1.0f,+0.5f,
+        -1.5f,1.0f,+0.5f, +1.5f,1.0f,+0.5f,
+        +1.5f,2.0f,+0.5f, -1.5f,2.0f,+0.5f,
+        -0.5f,2.0f,+0.5f, +0.5f,2.0f,+0.5f,
+        +0.5f,3.0f,+0.5f, -0.5f,3.0f,+0.5f,
+        +0.5f,0.0f,-0.5f, -0.5f,0.0f,-0.5f,
+        -0.5f,1.0f,-0.5f, +0.5f,1.0f,-0.5f,
+        +1.5f,1.0f,-0.5f, -1.5f,1.0f,-0.5f,
+        -1.5f,2.0f,-0.5f, +1.5f,2.0f,-0.5f,
+        +0.5f,2.0f,-0.5f, -0.5f,2.0f,-0.5f,
+        -0.5f,3.0f,-0.5f, +0.5f,3.0f,-0.5f};
+    const float healthstrip[]={
+        -0.5f,0.0f,+0.5f, -0.5f,0.0f,-0.5f,
+        +0.5f,0.0f,+0.5f, +0.5f,0.0f,-0.5f,
+        +0.5f,1.0f,+0.5f, +0.5f,1.0f,-0.5f,
+        +1.5f,1.0f,+0.5f, +1.5f,1.0f,-0.5f,
+        +1.5f,2.0f,+0.5f, +1.5f,2.0f,-0.5f,
+        +0.5f,2.0f,+0.5f, +0.5f,2.0f,-0.5f,
+        +0.5f,3.0f,+0.5f, +0.5f,3.0f,-0.5f,
+        -0.5f,3.0f,+0.5f, -0.5f,3.0f,-0.5f,
+        -0.5f,2.0f,+0.5f, -0.5f,2.0f,-0.5f,
+        -1.5f,2.0f,+0.5f, -1.5f,2.0f,-0.5f,
+        -1.5f,1.0f,+0.5f, -1.5f,1.0f,-0.5f,
+        -0.5f,1.0f,+0.5f, -0.5f,1.0f,-0.5f,
+        -0.5f,0.0f,+0.5f, -0.5f,0.0f,-0.5f};
+    const float ammofront[]={
+        -0.5f,3.0f,+0.5f, +1.5f,1.0f,+0.5f, -1.5f,2.0f,+0.5f,
+        +1.5f,0.0f,+0.5f, +0.5f,0.0f,+0.5f};
+    const float ammoback[]={
+        +1.5f,1.0f,-0.5f, -0.5f,3.0f,-0.5f, -1.5f,2.0f,-0.5f,
+        +1.5f,0.0f,-0.5f, +0.5f,0.0f,-0.5f};
+    const float ammostrip[]={
+        -0.5f,3.0f,+0.5f, -0.5f,3.0f,-0.5f,
+        +1.5f,1.0f,+0.5f, +1.5f,1.0f,-0.5f,
+        +1.5f,0.0f,+0.5f, +1.5f,0.0f,-0.5f,
+        +0.5f,0.0f,+0.5f, +0.5f,0.0f,-0.5f,
+        -1.5f,2.0f,+0.5f, -1.5f,2.0f,-0.5f,
+        -0.5f,3.0f,+0.5f, -0.5f,3.0f,-0.5f};
+
+    //corners shared within a kind are stored once, so each is transformed
+    //once per instance
+    inline void meshVertex(const float *v, int i, float scale, float lift){
+        const float x=v[i*3]*scale;
+        const float y=v[i*3+1]*scale+lift;
+        const float z=v[i*3+2]*scale;
+        int j=meshstart;
+        const int n=meshes.size()/3;
+        while(j<n && (meshes[j*3]!=x || meshes[j*3+1]!=y || meshes[j*3+2]!=z))
+            j++;
+        if(j==n){
+            meshes.push_back(x);
+            meshes.push_back(y);
+            meshes.push_back(z);
+        }
+        meshidx.push_back(j);
+    }
+
+    //one of the old glBegin blocks as triangles, n in vertices
+    void addMesh(GLenum prim, const float *v, int n, float scale, float lift){
+        switch(prim){
+        case GL_QUADS:
+            for(int q=0;q+3<n;q+=4){
+                meshVertex(v,q,scale,lift); meshVertex(v,q+1,scale,lift); meshVertex(v,q+3,scale,lift);
+                meshVertex(v,q+1,scale,lift); meshVertex(v,q+2,scale,lift); meshVertex(v,q+3,scale,lift);
+            }
+            break;
+        case GL_QUAD_STRIP:
+            for(int q=0;q+3<n;q+=2){
+                meshVertex(v,q,scale,lift); meshVertex(v,q+1,scale,lift); meshVertex(v,q+3,scale,lift);
+                meshVertex(v,q,scale,lift); meshVertex(v,q+3,scale,lift); meshVertex(v,q+2,scale,lift);
             }
+            break;
+        case GL_TRIANGLE_STRIP:
+            for(int t=0;t+2<n;t++){
+                meshVertex(v,t+(t&1),scale,lift);
+                meshVertex(v,t+1-(t&1),scale,lift);
+                meshVertex(v,t+2,scale,lift);
+            }
+            break;
         }
-        //ammo+health caches
-        int c=0;
-        for(int iz=1;iz<31;iz++)
-        for(int ix=1;ix<31;ix++)
-            if(map[iz*32+ix]&INSIDE_BIT && rng()<0.125f){
-                const unsigned char type=rng()<0.25f?Z_HEALTH:Z_AMMO;
-                const int s=rng.randInt(2)+rng.randInt(2);
-                const float posx=ix*16.0f+8.0f-(float)s*0.5f;
-                const float posz=iz*16.0f+8.0f-(float)s*0.5f;
-                for(int jz=0;jz<s;jz++)
-                for(int jx=0;jx<s;jx++){
-                    for(;c<MAX_ZEDS;c++)
-                        if(zed[c].state==Z_NONE){
-                            zed[c].state=type;
-                            zed[c].p.set(posx+jx,0.0f,posz+jz);
-                            zed[c].v.set(0.0f,0.0f,0.0f);
-                            zed[c].rot=0.0f;
-                            zed[c].ix=ix;
-                            zed[c].iz=iz;
-                            zed[c].cnext=-1;
-                            zed[c].cprev=-1;
-                            break;
-                        }
-                }
+    }
+
+    //pickups are drawn scaled and lifted by one of their units
+#define ADD_MESH(prim,v,scale,lift) addMesh(prim,v,sizeof(v)/sizeof(v[0])/3,scale,lift)
+    void buildMeshes(){
+        meshes.clear();
+        meshidx.clear();
+        for(int k=0;k<ENT_KINDS;k++){
+            meshfirst[k]=meshstart=meshes.size()/3;
+            idxfirst[k]=meshidx.size();
+            switch(k){
+            case ENT_ZED:
+            case ENT_PLAYER:
+                ADD_MESH(GL_QUAD_STRIP,zedstrip,1.0f,0.0f);
+                ADD_MESH(GL_QUADS,zedcaps,1.0f,0.0f);
+                break;
+            case ENT_DEAD:
+                ADD_MESH(GL_QUAD_STRIP,deadstrip,1.0f,0.0f);
+                ADD_MESH(GL_QUADS,deadcaps,1.0f,0.0f);
+                break;
+            case ENT_HEALTH:
+                ADD_MESH(GL_QUADS,healthfaces,PICKUPW,PICKUPW);
+                ADD_MESH(GL_QUAD_STRIP,healthstrip,PICKUPW,PICKUPW);
+                break;
+            case ENT_AMMO:
+                ADD_MESH(GL_TRIANGLE_STRIP,ammofront,PICKUPW,PICKUPW);
+                ADD_MESH(GL_TRIANGLE_STRIP,ammoback,PICKUPW,PICKUPW);
+                ADD_MESH(GL_QUAD_STRIP,ammostrip,PICKUPW,PICKUPW);
+                break;
             }
-        //zeds
-/*
-        for(int iz=1;iz<31;iz++)
-        for(int ix=1;ix<31;ix++){
-            if(abs(ix-15)+abs(iz-15)<3)
-                continue;
-            zed[c].state=Z_WANDERING;
-            zed[c].p.set(ix*16.0f+8.0f,0.0f,iz*16.0f+8.0f);
-            zed[c].v.set(0.0f,0.0f,0.0f);
-            zed[c].rot=rng()*M_PI*2;
-            zed[c].ix=ix;
-            zed[c].iz=iz;
-            zed[c].cnext=-1;
-            zed[c].cprev=-1;
-            cols[iz*32+ix]=c;
-            if(c+1<MAX_ZEDS)
-                c++;
+            meshcount[k]=meshes.size()/3-meshfirst[k];
+            idxcount[k]=meshidx.size()-idxfirst[k];
+        }
+    }
+#undef ADD_MESH
+
+    //-1 if the shader doesn't build, the log goes to stdout
+    int buildEntityShader(){
+        GLint ok=0;
+        const GLuint vs=createShader(GL_VERTEX_SHADER);
+        shaderSource(vs,1,&entshader,NULL);
+        compileShader(vs);
+        getShaderiv(vs,GL_COMPILE_STATUS,&ok);
+        if(!ok){
+            char log[1024];
+            getShaderInfoLog(vs,sizeof(log),NULL,log);
+            cout<<"entity shader: "<<log<<"\n";
+            return -1;
         }
-*/
+        entprog=createProgram();
+        attachShader(entprog,vs);
+        bindAttribLocation(entprog,INST_ATTRIB,"inst");
+        linkProgram(entprog);
+        getProgramiv(entprog,GL_LINK_STATUS,&ok);
+        if(!ok){
+            cout<<"entity shader: link failed\n";
+            return -1;
+        }
+        return 0;
+    }
 
-        for(int i=0;i<MAX_BULLETS;i++)
-            bullets[i].p.x=-1;
-        for(int i=0;i<MAX_PARTICLES;i++)
-            particles[i].p.x=-1;
-        for(int i=0;i<MAX_PLAYERS;i++)
-            pl[i].state=0;
+    void pickEntityMode(){
+        const char *cap=getenv("ZED_ENTITIES");
+        if(meshes.empty())
+            buildMeshes();
+        entmode=ENT_STREAM;
+        if(cap && !strcmp(cap,"immediate"))
+            entmode=ENT_IMMEDIATE;
+        if(cap || !haveinstancing)
+            return;
+        if(!entprog && buildEntityShader())
+            return;
+        if(!meshbuf){
+            genBuffers(1,&meshbuf);
+            genBuffers(1,&meshidxbuf);
+            genBuffers(1,&instbuf);
+        }
+        bindBuffer(GL_ARRAY_BUFFER_ARB,meshbuf);
+        bufferData(GL_ARRAY_BUFFER_ARB,meshes.size()*sizeof(float),&meshes[0],GL_STATIC_DRAW_ARB);
+        bindBuffer(GL_ARRAY_BUFFER_ARB,0);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,meshidxbuf);
+        bufferData(GL_ELEMENT_ARRAY_BUFFER_ARB,meshidx.size()*sizeof(GLushort),&meshidx[0],GL_STATIC_DRAW_ARB);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,0);
+        entmode=ENT_INSTANCED;
+    }
 
-        return 0;
+    void updateHealthHud(){
+        if(plid!=-1){
+            const float r=(float)pl[plid].health/100.0f;
+            for(int i=0;i<400;i++)
+                healthhud[i]=hudrng()<r?1:0;
+            hudhealth=pl[plid].health;
+        }
     }
 
     int initClient(){
-        isserver=false;
-
         //sdl
         if(!sdl_started){
             sdl_started=true;
@@ -368,6 +623,9 @@ namespace Game{
             }
             atexit(SDL_Quit);
             SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER,1);
+            const char *vsync=getenv("ZED_VSYNC");
+            if(vsync)
+                SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL,strcmp(vsync,"off")?1:0);
             screen=SDL_SetVideoMode(WINDOW_W,WINDOW_H,32,SDL_OPENGL|(FULLSCREEN?SDL_FULLSCREEN:0));
             if(screen==NULL){
                 cerr<<"unable to set video mode: "<<SDL_GetError()<<endl;
@@ -396,29 +654,33 @@ namespace Game{
 
 	glClearColor(0.0f,0.0f,0.0f,0.0f);
         glViewport(0,0,WINDOW_W,WINDOW_H);
+        loadExtensions();
+        pickCityMode();
+        citybaked=false;
+        pickEntityMode();
+
+        const char *fps=getenv("ZED_FPS");
+        framecap=fps && atoi(fps)>0?1.0/atoi(fps):0;
 
         //game vars
         frames=0;
+        ticks=0;
+        reportframes=0;
+        reportticks=0;
+        reportstart=clockSeconds();
+        framedue=reportstart;
+        lastframe=-1;
+        tickclock=0;
+        blend=1.0f;
+        inputms=0;
+        usequeued=false;
         plid=-1;
-
-        if(map) delete[] map;
-        map=new char[32*32];
-        if(cols) delete[] cols;
-        cols=new int[32*32];
-        //clear
-        for(int i=0;i<32*32;i++)
-            map[i]=0;
-        for(int i=0;i<32*32;i++)
-            cols[i]=-1;
-        for(int i=0;i<MAX_ZEDS;i++)
-            zed[i].state=Z_NONE;
-
-        for(int i=0;i<MAX_BULLETS;i++)
-            bullets[i].p.x=-1;
-        for(int i=0;i<MAX_PARTICLES;i++)
-            particles[i].p.x=-1;
+        hudhealth=-1;
+        inputseq=ackedinput=sentinput=0;
         for(int i=0;i<MAX_PLAYERS;i++)
-            pl[i].state=0;
+            nsamples[i]=0;
+        servertick=-1;
+        resetWorld();
 
         return 0;
     }
@@ -431,326 +693,6 @@ namespace Game{
         return isKeyDown[k];
     }
 
-    inline float sqr(float x){ return x*x; }
-
-    void updateColInfo(const int i){
-        const int ix=zed[i].p.x/16.0f;
-        const int iz=zed[i].p.z/16.0f;
-        if(zed[i].ix!=ix || zed[i].iz!=iz){
-            if(zed[i].cnext!=-1)
-                zed[zed[i].cnext].cprev=zed[i].cprev;
-            if(zed[i].cprev!=-1)
-                zed[zed[i].cprev].cnext=zed[i].cnext;
-            else
-                cols[zed[i].iz*32+zed[i].ix]=zed[i].cnext;
-            zed[i].cprev=-1;
-            zed[i].cnext=cols[iz*32+ix];
-            zed[zed[i].cnext].cprev=i;
-            cols[iz*32+ix]=i;
-            zed[i].ix=ix;
-            zed[i].iz=iz;
-        }
-    }
-
-    void makeZedOBB(OBB* b, const int c){
-        const float ZEDW2=0.565685425f;
-        b->p.set(zed[c].p);
-        if(zed[c].state==Z_DEAD){
-            b->p.y+=ZEDW2;
-            b->e.set(vect(1.4f,ZEDW2,ZEDW2));
-            b->rotatey(-zed[c].rot);
-        }else{
-            b->p.y+=1.4f;
-            b->e.set(vect(ZEDW2,1.4f,ZEDW2));
-            b->rotatey(-zed[c].rot-M_PI/4);
-        }
-    }
-
-    bool intersectionOBB(const OBB& a, const OBB& b){
-        vect t(b.p);
-        a.wtol(t);
-        //rotation matrix
-        vect rx(dot(a.ax,b.ax),dot(a.ax,b.ay),dot(a.ax,b.az));
-        vect ry(dot(a.ay,b.ax),dot(a.ay,b.ay),dot(a.ay,b.az));
-        vect rz(dot(a.az,b.ax),dot(a.az,b.ay),dot(a.az,b.az));
-        //a's basis vectors
-        if(fabs(t.x) > a.e.x+b.e.x*fabs(rx.x)+b.e.y*fabs(rx.y)+b.e.z*fabs(rx.z)) return false;
-        if(fabs(t.y) > a.e.y+b.e.x*fabs(ry.x)+b.e.y*fabs(ry.y)+b.e.z*fabs(ry.z)) return false;
-        if(fabs(t.z) > a.e.z+b.e.x*fabs(rz.x)+b.e.y*fabs(rz.y)+b.e.z*fabs(rz.z)) return false;
-        //b's basis vectors
-        if(fabs(t.x*rx.x+t.y*ry.x+t.z*rz.x) > b.e.x
-        + a.e.x*fabs(rx.x)+a.e.y*fabs(ry.x)+a.e.z*fabs(rz.x)) return false;
-        if(fabs(t.x*rx.y+t.y*ry.y+t.z*rz.y) > b.e.y
-        + a.e.x*fabs(rx.y)+a.e.y*fabs(ry.y)+a.e.z*fabs(rz.y)) return false;
-        if(fabs(t.x*rx.z+t.y*ry.z+t.z*rz.z) > b.e.z
-        + a.e.x*fabs(rx.z)+a.e.y*fabs(ry.z)+a.e.z*fabs(rz.z)) return false;
-        //9 cross products
-        if(fabs(t.z*ry.x-t.y*rz.x) > a.e.y*fabs(rz.x)+a.e.z*fabs(ry.x)
-        + b.e.y*fabs(rx.z)+b.e.z*fabs(rx.y)) return false;
-        if(fabs(t.z*ry.y-t.y*rz.y) > a.e.y*fabs(rz.y)+a.e.z*fabs(ry.y)
-        + b.e.x*fabs(rx.z)+b.e.z*fabs(rx.x)) return false;
-        if(fabs(t.z*ry.z-t.y*rz.z) > a.e.y*fabs(rz.z)+a.e.z*fabs(ry.z)
-        + b.e.x*fabs(rx.y)+b.e.y*fabs(rx.x)) return false;
-        if(fabs(t.x*rz.x-t.z*rx.x) > a.e.x*fabs(rz.x)+a.e.z*fabs(rx.x)
-        + b.e.y*fabs(ry.z)+b.e.z*fabs(ry.y)) return false;
-        if(fabs(t.x*rz.y-t.z*rx.y) > a.e.x*fabs(rz.y)+a.e.z*fabs(rx.y)
-        + b.e.x*fabs(ry.z)+b.e.z*fabs(ry.x)) return false;
-        if(fabs(t.x*rz.z-t.z*rx.z) > a.e.x*fabs(rz.z)+a.e.z*fabs(rx.z)
-        + b.e.x*fabs(ry.y)+b.e.y*fabs(ry.x)) return false;
-        if(fabs(t.y*rx.x-t.x*ry.x) > a.e.x*fabs(ry.x)+a.e.y*fabs(rx.x)
-        + b.e.y*fabs(rz.z)+b.e.z*fabs(rz.y)) return false;
-        if(fabs(t.y*rx.y-t.x*ry.y) > a.e.x*fabs(ry.y)+a.e.y*fabs(rx.y)
-        + b.e.x*fabs(rz.z)+b.e.z*fabs(rz.x)) return false;
-        if(fabs(t.y*rx.z-t.x*ry.z) > a.e.x*fabs(ry.z)+a.e.y*fabs(rx.z)
-        + b.e.x*fabs(rz.y)+b.e.y*fabs(rz.x)) return false;
-        return true;
-    }
-
-    //returns max of 0-none, 1-wall, 2-side of block, 3-zed
-    int collideCharacter(const int me, bool isplayer, float& x, float& y, float& z, const float rad){
-        int ret=0;
-        if(x<16.0f+rad){ x=16.0f+rad; ret=1; }
-        if(z<16.0f+rad){ z=16.0f+rad; ret=1; }
-        if(x>31.0f*16.0f-rad){ x=31.0f*16.0f-rad; ret=1; }
-        if(z>31.0f*16.0f-rad){ z=31.0f*16.0f-rad; ret=1; }
-        const int ix=x/16.0f;
-        const int iz=z/16.0f;
-        const int i=iz*32+ix;
-        const float offx=x-ix*16.0f;
-        const float offz=z-iz*16.0f;
-        //zeds
-        const int jx=offx<8.0f?ix-1:ix+1;
-        const int jz=offz<8.0f?iz-1:iz+1;
-        const int cs[4]={cols[iz*32+ix],cols[iz*32+jx],cols[jz*32+ix],cols[jz*32+jx]};
-        for(int ic=0;ic<4;ic++){
-            int c=cs[ic];
-            while(c!=-1){
-                if(!isplayer && c==me){
-                    c=zed[c].cnext;
-                    continue;
-                }
-                if(zed[c].state==Z_DEAD){
-                    //upright-obb-upright-cylinder test
-                    OBB b;
-                    makeZedOBB(&b,c);
-                    vect p(x,y,z);
-                    b.wtol(p);
-                    if(!(p.y<-2.8f || p.y>b.e.y)){
-                        bool ontop=p.y>b.e.y-0.3f;
-                        bool hit=false;
-                        if(fabs(p.x)<b.e.x){
-                            if(fabs(p.z)<b.e.z+rad){
-                                hit=true;
-                                if(!ontop){
-                                    p.z=p.z>0?(b.e.z+rad+0.001f):-(b.e.z+rad+0.001f);
-                                    b.ltow(p); x=p.x; z=p.z;
-                                }
-                            }
-                        }else if(fabs(p.z)<b.e.z){
-                            if(fabs(p.x)<b.e.x+rad){
-                                hit=true;
-                                if(!ontop){
-                                    p.x=p.x>0?(b.e.x+rad+0.001f):-(b.e.x+rad+0.001f);
-                                    b.ltow(p); x=p.x; z=p.z;
-                                }
-                            }
-                        }else if(sqr(fabs(p.x)-b.e.x)+sqr(fabs(p.z)-b.e.z)<rad*rad){
-                            hit=true;
-                            if(!ontop){
-                                const float ddx=p.x>0?(p.x-b.e.x):(p.x+b.e.x);
-                                const float ddz=p.z>0?(p.z-b.e.z):(p.z+b.e.z);
-                                const float dist=sqrtf(ddx*ddx+ddz*ddz);
-                                p.x+=(rad-dist+0.001f)*ddx/dist;
-                                p.z+=(rad-dist+0.001f)*ddz/dist;
-                                b.ltow(p); x=p.x; z=p.z;
-                            }
-                        }
-                        if(hit && ontop){
-                            if(isplayer){
-                                if(pl[me].v.y<0){
-                                    p.y=b.e.y; b.ltow(p);
-                                    pl[me].p.y=p.y;
-                                    pl[me].v.y=0;
-                                }
-                                pl[me].onground=true;
-                            }else{
-                                if(zed[me].v.y<0){
-                                    p.y=b.e.y; b.ltow(p);
-                                    zed[me].p.y=p.y;
-                                    zed[me].v.y=0;
-                                }
-                            }
-                        }else if(hit)
-                            if(ret<2) ret=2;
-                    }
-                }else if(sqr(x-zed[c].p.x)+sqr(z-zed[c].p.z)<2.56f && y+2.8f<zed[c].p.y && zed[c].p.y+2.8f<y){
-                    const float dist=sqrtf(sqr(x-zed[c].p.x)+sqr(z-zed[c].p.z));
-                    x+=(1.60f-dist)*(x-zed[c].p.x)/dist;
-                    z+=(1.60f-dist)*(z-zed[c].p.z)/dist;
-                    ret=3;
-                }
-                c=zed[c].cnext;
-            }
-        }
-        //walls
-        const float lastx=x;
-        const float lastz=z;
-        if(offx<rad){
-            if( (map[i]&INSIDE_BIT || map[i-1]&INSIDE_BIT)
-                && !(map[i-1]&DOORX_BIT && offz>4+rad && offz<8-rad) )
-                x+=rad-offx;
-        }else if(offx>16.0f-rad){
-            if( (map[i]&INSIDE_BIT || map[i+1]&INSIDE_BIT)
-                && !(map[i]&DOORX_BIT && offz>4+rad && offz<8-rad) )
-                x+=16.0f-rad-offx;
-        }
-        if(offz<rad){
-            if( (map[i]&INSIDE_BIT || map[i-32]&INSIDE_BIT)
-                && !(map[i-32]&DOORZ_BIT && offx>4+rad && offx<8-rad) )
-                z+=rad-offz;
-        }else if(offz>16.0f-rad){
-            if( (map[i]&INSIDE_BIT || map[i+32]&INSIDE_BIT)
-                && !(map[i]&DOORZ_BIT && offx>4+rad && offx<8-rad) )
-                z+=16.0f-rad-offz;
-        }
-        if(!isplayer)
-            updateColInfo(me);
-        if(ret<1 && x!=lastx || z!=lastz)
-            ret=1;
-        return ret;
-    }
-
-    inline float abs(float x){ return x>0?x:-x; }
-
-    int collideLine(float x, float y, float z, float dx, float dy, float dz){
-        //>=0 on zed collision, -1 on NO collision, -2 otherwise
-        if(x<16.0f || x>31.0f*16.0f || z<16.0f || z>31.0f*16.0f || y<0.0f || y>48.0f)
-            return -2;
-        const int ix=x/16.0f;
-        const int iz=z/16.0f;
-        const int ix2=(x+dx)/16.0f;
-        const int iz2=(z+dz)/16.0f;
-        const float offx=x-ix*16.0f;
-        const float offz=z-iz*16.0f;
-        const float halfdx=dx*0.5f;
-        const float halfdy=dy*0.5f;
-        const float halfdz=dz*0.5f;
-        if(ix2!=ix || iz2!=iz){
-            //across block edge
-            if(abs(ix-ix2)+abs(iz-iz2)>1){
-                int r=collideLine(x,y,z,halfdx,halfdy,halfdz);
-                if(r!=-1)
-                    return r;
-                return collideLine(x+halfdx,y+halfdy,z+halfdz,halfdx,halfdy,halfdz);
-            }
-            float p,px,py,pz;
-            if(ix2-ix){
-                if(!(map[iz*32+ix]&INSIDE_BIT || map[iz*32+ix2]&INSIDE_BIT))
-                    goto nowallhit;
-                px=max(ix,ix2)*16.0f;
-                p=(px-x)/dx;
-                pz=z+dz*p;
-                py=y+dy*p;
-                if(py<6.0f && map[iz*32+min(ix,ix2)]&DOORX_BIT){
-                    const float offz=pz-iz*16.0f;
-                    if(offz>4.0f && offz<8.0f)
-                        goto nowallhit;
-                }
-            }else{
-                if(!(map[iz*32+ix]&INSIDE_BIT || map[iz2*32+ix]&INSIDE_BIT))
-                    goto nowallhit;
-                pz=max(iz,iz2)*16.0f;
-                p=(pz-z)/dz;
-                px=x+dx*p;
-                py=y+dy*p;
-                if(py<6.0f && map[min(iz,iz2)*32+ix]&DOORZ_BIT){
-                    const float offx=px-ix*16.0f;
-                    if(offx>4.0f && offx<8.0f)
-                        goto nowallhit;
-                }
-            }
-            if(py>15.0f) //ceiling
-                return -1;
-            return -2; //wall hit
-        }
-        nowallhit:
-        const int jx2=offx<8.0f?ix2-1:ix2+1;
-        const int jz2=offz<8.0f?iz2-1:iz2+1;
-        const int cs[4]={cols[iz2*32+ix2],cols[iz2*32+jx2],cols[jz2*32+ix2],cols[jz2*32+jx2]};
-        //const float maxdistsq=sqr(sqrt(halfdx*halfdx+halfdy*halfdy+halfdz*halfdz)+0.80f);
-        for(int ic=0;ic<4;ic++){
-            int c=cs[ic];
-            while(c!=-1){
-                //obb-segment test against zed[c]
-                OBB b;
-                makeZedOBB(&b,c);
-                vect p1(x,y,z);
-                vect p2(x+halfdx,y+halfdy,z+halfdz);
-
-                b.wtol(p1);
-                b.wtol(p2);
-                vect l(p2); l.sub(p1); l.normalize();
-                vect t(p2);
-                p2.sub(p1);
-                if(!(fabs(t.x) > b.e.x+fabs(p2.x)
-                ||   fabs(t.y) > b.e.y+fabs(p2.y)
-                ||   fabs(t.z) > b.e.z+fabs(p2.z)
-                || fabs(t.y*l.z-t.z*l.y) > b.e.y*fabs(l.z)+b.e.z*fabs(l.y)
-                || fabs(t.x*l.z-t.z*l.x) > b.e.z*fabs(l.x)+b.e.x*fabs(l.z)
-                || fabs(t.x*l.y-t.y*l.x) > b.e.x*fabs(l.y)+b.e.y*fabs(l.x)))
-                    return c;
-                /*if(sqr(x+halfdx-zed[c].p.x)+sqr(z+halfdz-zed[c].p.z)<maxdistsq){
-                    float nearx,neary,nearz;
-                    if(abs(dx)>abs(dz)){
-                        nearx=((zed[c].p.z-z)*dx*dz+x*dz*dz+zed[c].p.x*dx*dx)/(dx*dx+dz*dz);
-                        const float p=(nearx-x)/dx;
-                        nearz=z+dz*p;
-                        neary=y+dy*p;
-                    }else{
-                        nearz=((zed[c].p.x-x)*dx*dz+z*dx*dx+zed[c].p.z*dz*dz)/(dx*dx+dz*dz);
-                        const float p=(nearz-z)/dz;
-                        nearx=x+dx*p;
-                        neary=y+dy*p;
-                    }
-                    const float dist=sqrtf(sqr(zed[c].p.x-nearx)+sqr(zed[c].p.z-nearz));
-                    //this neary check isn't entirely accurate
-                    if(dist<0.80f && neary<2.8f+(0.80f-dist)*abs(dy/sqrtf(dx*dx+dz*dz))){
-                        return c;
-                    }
-                }*/
-                c=zed[c].cnext;
-            }
-        }
-        return -1;
-    }
-
-    void hitZed(const int i){
-        if(zed[i].state==Z_DEAD){
-            /*const float RAD=0.80f;
-            int count=12;
-            for(int j=0;j<MAX_PARTICLES;j++)
-                if(particles[j].p.x==-1){
-                    particles[j].p.x=zed[i].p.x+rng.rand(RAD*2)-RAD;
-                    particles[j].p.y=zed[i].p.y+rng.rand(2.8f);
-                    particles[j].p.z=zed[i].p.z+rng.rand(RAD*2)-RAD;
-                    particles[j].age=rng.rand(0.20f)+0.20f;
-                    if((--count)<=0)
-                        break;
-                }*/
-            if(zed[i].cnext!=-1)
-                zed[zed[i].cnext].cprev=zed[i].cprev;
-            if(zed[i].cprev!=-1)
-                zed[zed[i].cprev].cnext=zed[i].cnext;
-            else
-                cols[zed[i].iz*32+zed[i].ix]=zed[i].cnext;
-            zed[i].cprev=-1;
-            zed[i].cnext=-1;
-            zed[i].state=Z_NONE;
-        }else{
-            zed[i].state=Z_DEAD;
-        }
-    }
-
     int pollEvents(){
         for(int i=0;i<SDLK_LAST;i++) isKeyPressed[i]=false;
         SDL_Event event;
@@ -786,40 +728,24 @@ namespace Game{
         return 0;
     }
 
-    int updateFrame(){
-        const float MAX_TIMESTEP=0.1f;
-        const float GRAVITY=30.0f;
-        const float WALK_SPEED=10.0f;
-        const float JUMP_SPEED=10.0f;
-        const float CLIMB_SPEED=3.0f;
-        const float BULLET_SPEED=70.0f;
-        const float SHOOT_DELAY=0.20f;
-        const float PARTICLE_AGE=0.10f;
-        const float PARTICLE_INTERVAL=1.0f;
-        const float PL_RAD=0.80f;
-        const float ZED_RANGE=32.0f;
-        const int ZED_DAMAGE=30;
-
-        if(!isserver && (pollEvents() || keyPressed(SDLK_F10)))
-            return -1;
-        if(!isserver && gamestate==0)
-            return 0;
-
-        const Uint32 time=SDL_GetTicks();
-        static Uint32 timeLast=time;
-        const float t=min((float)(time-timeLast)/1000.0f,MAX_TIMESTEP);
-        timeLast=time;
-        if(t<=0)
-            return 0;
+    void runTick(const float t){
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            prevzx[i]=zed.px[i];
+            prevzy[i]=zed.py[i];
+            prevzz[i]=zed.pz[i];
+            prevrot[i]=zed.rot[i];
+        }
 
-        if(!isserver && plid>=0){
+        if(plid>=0){
+            prevown.set(pl[plid].p);
             unsigned char mb=SDL_GetMouseState(NULL,NULL);
             bool K_LEFT=keyDown(SDLK_a);
             bool K_RIGHT=keyDown(SDLK_d);
             bool K_FORWARD=keyDown(SDLK_w);
             bool K_BACK=keyDown(SDLK_s);
             bool K_JUMP=keyDown(SDLK_SPACE);
-            bool K_USE=keyPressed(SDLK_e);
+            bool K_USE=usequeued;
             bool K_FIRE=mb&SDL_BUTTON(1);
             pl[plid].keys=0;
             pl[plid].keys|=K_LEFT    ? KB_LEFT    :0;
@@ -829,446 +755,740 @@ namespace Game{
             pl[plid].keys|=K_JUMP    ? KB_JUMP    :0;
             pl[plid].keys|=K_USE     ? KB_USE     :0;
             pl[plid].keys|=K_FIRE    ? KB_FIRE    :0;
-        }
 
-        for(int p=0;p<MAX_PLAYERS;p++) if(pl[p].state){
-            //player movement
-            float dirx=0;
-            float diry=0;
-            if(pl[p].keys&KB_FORWARD) diry+=1.0f;
-            if(pl[p].keys&KB_LEFT) dirx-=1.0f;
-            if(pl[p].keys&KB_BACK) diry-=1.0f;
-            if(pl[p].keys&KB_RIGHT) dirx+=1.0f;
-            if(dirx!=0 && diry!=0){
-                dirx*=0.70710678;
-                diry*=0.70710678;
-            }
-            const float lasty=pl[p].p.y;
-            pl[p].v.x=WALK_SPEED*(diry*cosf(pl[p].lookr)-dirx*sinf(pl[p].lookr));
-            pl[p].v.z=WALK_SPEED*(dirx*cosf(pl[p].lookr)+diry*sinf(pl[p].lookr));
-            pl[p].p.adds(pl[p].v,t);
-            if(pl[p].p.y>0){
-                pl[p].v.y-=GRAVITY*t;
-            }else{
-                pl[p].p.y=0;
-                pl[p].v.y=0;
-                pl[p].onground=true;
-            }
-            if(collideCharacter(p,true,pl[p].p.x,pl[p].p.y,pl[p].p.z,PL_RAD)==2){
-                if(pl[p].v.y<CLIMB_SPEED)
-                    pl[p].v.y=CLIMB_SPEED;
-                pl[p].onground=true;
-            }
-            if(pl[p].keys&KB_JUMP && pl[p].onground){
-                pl[p].v.y=JUMP_SPEED;
-                pl[p].p.y+=0.01f;
-                pl[p].onground=false;
-            }
-            if(pl[p].p.y<lasty)
-                pl[p].onground=false;
-            const vect aim(cosf(pl[p].lookr)*cosf(pl[p].lookp),
-                            sinf(pl[p].lookp),
-                            sinf(pl[p].lookr)*cosf(pl[p].lookp));
-
-            if(p==plid){
-                cam.set(pl[p].p);
-                cam.y+=2.5f;
-                look.set(cam).add(aim);
+            //predict our own movement with the inputs we're about to send.
+            //inputs carry whole ms up to what the server accepts, a longer
+            //tick is split over several and the leftover goes to the next
+            //tick so they add up to the time simulated
+            inputms+=t*1000.0f;
+            while(inputms>=1.0f){
+                Input &in=inputs[(++inputseq)%INPUT_RING];
+                in.seq=inputseq;
+                in.keys=pl[plid].keys;
+                in.aimr=getAimr(plid);
+                in.aimp=getAimp(plid);
+                in.msec=(unsigned char)min((int)inputms,Net::MAX_INPUT_MSEC);
+                inputms-=in.msec;
+                movePlayer(plid,in);
             }
+        }
+        usequeued=false;
 
-            //pickup
-            if(pl[p].keys&KB_USE && (pl[p].health<100 || pl[p].ammo<120))
-                for(int i=0;i<MAX_ZEDS;i++)
-                    if((zed[i].state==Z_HEALTH || zed[i].state==Z_AMMO)
-                        && sqr(pl[p].p.x-zed[i].p.x)+sqr(pl[p].p.z-zed[i].p.z)<PL_RAD*PL_RAD*4){
-                        if(zed[i].state==Z_HEALTH){
-                            if(pl[p].health<100){
-                                pl[p].health+=25;
-                                if(pl[p].health>100)
-                                    pl[p].health=100;
-                                if(p==plid)
-                                    updateHealthHud();
-                                zed[i].state=Z_NONE;
-                                break;
-                            }
-                        }else{
-                            if(pl[p].ammo<120){
-                                pl[p].ammo+=30;
-                                if(pl[p].ammo>120)
-                                    pl[p].ammo=120;
-                                zed[i].state=Z_NONE;
-                                break;
-                            }
-                        }
-                    }
+        step(t);
+        ticks++;
+    }
 
-            //shooting
-            if(pl[p].shootdelay>0)
-                pl[p].shootdelay-=t;
-            if(pl[p].ammo>0 && pl[p].keys&KB_FIRE && pl[p].shootdelay<=0){
-                for(int i=0;i<MAX_BULLETS;i++)
-                    if(bullets[i].p.x==-1){
-                        bullets[i].p.set(pl[p].p).adds(aim,0.75f);
-                        bullets[i].p.y+=2.5f-0.3f;
-                        bullets[i].v.set(pl[p].v).adds(aim,BULLET_SPEED);
-                        bullets[i].v.y+=0.15f*GRAVITY;
-                        pl[p].ammo--;
-                        break;
-                    }
-                pl[p].shootdelay=SHOOT_DELAY;
-            }
-        }
+    int updateFrame(){
+        const double MAX_FRAME=0.1; //a longer stall is dropped, not caught up
 
-        //bullets
-        for(int i=0;i<MAX_BULLETS;i++)
-            if(bullets[i].p.x!=-1){
-                const float dx=bullets[i].v.x*t;
-                const float dy=bullets[i].v.y*t;
-                const float dz=bullets[i].v.z*t;
-                int c;
-                if((c=collideLine(bullets[i].p.x,bullets[i].p.y,bullets[i].p.z,dx,dy,dz))!=-1){
-                    if(c>=0){ //hit zed
-                        hitZed(c);
-                    }
-                    for(int j=0;j<MAX_PARTICLES;j++)
-                        if(particles[j].p.x==-1){
-                            particles[j].p.set(bullets[i].p);
-                            particles[j].age=PARTICLE_AGE*4.0f;
-                            break;
-                        }
-                    bullets[i].p.x=-1;
-                    continue;
-                }
-                bullets[i].v.y-=GRAVITY*t;
-                float dist=sqrtf(dx*dx+dy*dy+dz*dz);
-                for(int j=0;j<MAX_PARTICLES;j++)
-                    if(particles[j].p.x==-1){
-                        particles[j].p.set(bullets[i].p).add(dx*dist,dy*dist,dz*dist);
-                        particles[j].age=PARTICLE_AGE;
-                        if((dist-=PARTICLE_INTERVAL)<=0)
-                            break;
-                    }
-                bullets[i].p.add(dx,dy,dz);
-            }
+        if(pollEvents() || keyPressed(SDLK_F10))
+            return -1;
+        if(gamestate==0)
+            return 0;
+        if(keyPressed(SDLK_e))
+            usequeued=true;
+
+        const double now=clockSeconds();
+        if(lastframe<0)
+            lastframe=now;
+        const double frame=max(0.0,min(now-lastframe,MAX_FRAME));
+        lastframe=now;
+
+        if(servertick>=0){
+            servertick+=frame*tickrate;
+            const double rendertick=servertick-interpdelay*tickrate;
+            for(int p=0;p<MAX_PLAYERS;p++) if(pl[p].state && p!=plid)
+                if(!expirePlayer(p))
+                    interpolatePlayer(p,rendertick);
+        }
 
-        //particles
-        for(int i=0;i<MAX_PARTICLES;i++)
-            if(particles[i].p.x!=-1){
-                particles[i].age-=t;
-                if(particles[i].age<0)
-                    particles[i].p.x=-1;
-            }
+        const double dt=1.0/tickrate;
+        tickclock+=frame;
+        while(tickclock>=dt){
+            tickclock-=dt;
+            runTick((float)dt);
+        }
+        blend=(float)(tickclock/dt);
 
-        //zeds
-        for(int i=0;i<MAX_ZEDS;i++) if(zed[i].state!=Z_NONE){
-            switch(zed[i].state){
-                case Z_DEAD: break;
-                case Z_WANDERING: {
-                    //wander aimlessly
-                    zed[i].p.x+=WALK_SPEED*1.5f*cosf(zed[i].rot)*t;
-                    zed[i].p.z+=WALK_SPEED*1.5f*sinf(zed[i].rot)*t;
-                    switch(collideCharacter(i,false,zed[i].p.x,zed[i].p.y,zed[i].p.z,PL_RAD)){
-                    case 0:
-                        for(int p=0;p<MAX_PLAYERS;p++) if(pl[p].state)
-                            if(sqr(pl[p].p.x-zed[i].p.x)+sqr(pl[p].p.z-zed[i].p.z)<2.56f){
-                                const float dist=sqrtf(sqr(zed[i].p.x-pl[p].p.x)+sqr(zed[i].p.z-pl[p].p.z));
-                                zed[i].p.x+=(1.60f-dist)*(zed[i].p.x-pl[p].p.x)/dist;
-                                zed[i].p.z+=(1.60f-dist)*(zed[i].p.z-pl[p].p.z)/dist;
-                                zed[i].rot=rng.rand(M_PI*2);
-                            }
-                        break;
-                    case 2:
-                        if(zed[i].v.y<CLIMB_SPEED)
-                            zed[i].v.y=CLIMB_SPEED;
-                        break;
-                    default:
-                        zed[i].rot=rng.rand(M_PI*2);
-                        for(int p=0;p<MAX_PLAYERS;p++) if(pl[p].state)
-                            if(sqr(pl[p].p.x-zed[i].p.x)+sqr(pl[p].p.z-zed[i].p.z)<ZED_RANGE*ZED_RANGE){
-                                zed[i].state=Z_ATTACKING;
-                                zed[i].rot=atan2f(pl[p].p.z-zed[i].p.z,pl[p].p.x-zed[i].p.x);
-                            }
-                    }
-                    if(zed[i].p.y>=0){
-                        zed[i].p.y+=zed[i].v.y*t;
-                        zed[i].v.y-=GRAVITY*t;
-                    }else{
-                        zed[i].p.y=0;
-                        zed[i].v.y=0;
-                    }
-                    } break;
-                case Z_ATTACKING: {
-                    zed[i].p.x+=WALK_SPEED*1.5f*cosf(zed[i].rot)*t;
-                    zed[i].p.z+=WALK_SPEED*1.5f*sinf(zed[i].rot)*t;
-                    for(int p=0;p<MAX_PLAYERS;p++) if(pl[p].state)
-                        if(sqr(pl[p].p.x-zed[i].p.x)+sqr(pl[p].p.z-zed[i].p.z)<2.56f){
-                            pl[p].health-=ZED_DAMAGE;
-                            if(pl[p].health<0)
-                                respawnPlayer(0);
-                            if(p==plid)
-                                updateHealthHud();
-                            zed[i].state=Z_WANDERING;
-                            zed[i].rot=rng.rand(M_PI*2);
-                        }
-                    switch(collideCharacter(i,false,zed[i].p.x,zed[i].p.y,zed[i].p.z,PL_RAD)){
-                    case 0:
-                        break;
-                    case 2:
-                        if(zed[i].v.y<CLIMB_SPEED)
-                            zed[i].v.y=CLIMB_SPEED;
-                        break;
-                    default:
-                        zed[i].state=Z_WANDERING;
-                        zed[i].rot=rng.rand(M_PI*2);
-                    }
-                    if(zed[i].p.y>=0){
-                        zed[i].p.y+=zed[i].v.y*t;
-                        zed[i].v.y-=GRAVITY*t;
-                    }else{
-                        zed[i].p.y=0;
-                        zed[i].v.y=0;
-                    }
-                    } break;
-                case Z_HEALTH:
-                case Z_AMMO:
-                    zed[i].rot+=t*3.0f;
-                    break;
-                default:
-                    break;
-            }
+        if(plid>=0){
+            cam.set(pl[plid].p).sub(prevown);
+            if(len(cam)<camsnap)
+                cam.set(prevown).adds(pl[plid].p,blend).adds(prevown,-blend);
+            else
+                cam.set(pl[plid].p);
+            cam.y+=2.5f;
+            look.set(cosf(pl[plid].lookr)*cosf(pl[plid].lookp),
+                    sinf(pl[plid].lookp),
+                    sinf(pl[plid].lookr)*cosf(pl[plid].lookp)).add(cam);
+            if(pl[plid].health!=hudhealth)
+                updateHealthHud();
         }
 
         return 0;
     }
 
+    //sleep off what is left of the frame, the last ms is spun since
+    //SDL_Delay can oversleep
+    void paceFrame(){
+        if(framecap<=0)
+            return;
+        const double now=clockSeconds();
+        framedue+=framecap;
+        if(framedue<now-framecap) //fell behind, start over rather than rush
+            framedue=now;
+        const double left=framedue-now;
+        if(left>0.002)
+            SDL_Delay((Uint32)((left-0.001)*1000));
+        while(clockSeconds()<framedue)
+            ;
+    }
+
 
 
+    inline void cityColor(float c){
+        citycol=(GLubyte)(c*255.0f+0.5f);
+    }
+    inline void cityVertex(int x, int y, int z){
+        CityVertex v;
+        v.x=(GLshort)x;
+        v.y=(GLshort)y;
+        v.z=(GLshort)z;
+        v.w=1;
+        v.r=v.g=v.b=citycol;
+        v.a=255;
+        city.push_back(v);
+    }
+
     const int CEILING=15;
     const int DOORHEIGHT=6;
-    inline void drawCeiling(int ix, int iy){
-        glColor3f(0.55f,0.55f,0.55f);
-        glVertex3i(ix*16,CEILING,iy*16); glVertex3i(ix*16,CEILING,(iy+1)*16);
-        glVertex3i((ix+1)*16,CEILING,(iy+1)*16); glVertex3i((ix+1)*16,CEILING,iy*16);
+    inline void bakeCeiling(int ix, int iy){
+        cityColor(0.55f);
+        cityVertex(ix*16,CEILING,iy*16); cityVertex(ix*16,CEILING,(iy+1)*16);
+        cityVertex((ix+1)*16,CEILING,(iy+1)*16); cityVertex((ix+1)*16,CEILING,iy*16);
     }
-    inline void drawRoad(int ix, int iy, float col){
-        glColor3f(col,col,col);
-        glVertex3i(ix*16,0,iy*16); glVertex3i(ix*16,0,(iy+1)*16);
-        glVertex3i((ix+1)*16,0,(iy+1)*16); glVertex3i((ix+1)*16,0,iy*16);
+    inline void bakeRoad(int ix, int iy, float col){
+        cityColor(col);
+        cityVertex(ix*16,0,iy*16); cityVertex(ix*16,0,(iy+1)*16);
+        cityVertex((ix+1)*16,0,(iy+1)*16); cityVertex((ix+1)*16,0,iy*16);
     }
-    inline void drawHighWall(int ix, int iy, int jx, int jy){
-        glColor3f(0.50f,0.50f,0.50f);
-        glVertex3i(ix*16,0,iy*16); glVertex3i(jx*16,0,jy*16);
-        glVertex3i(jx*16,CEILING*4,jy*16); glVertex3i(ix*16,CEILING*4,iy*16);
+    inline void bakeHighWall(int ix, int iy, int jx, int jy){
+        cityColor(0.50f);
+        cityVertex(ix*16,0,iy*16); cityVertex(jx*16,0,jy*16);
+        cityVertex(jx*16,CEILING*4,jy*16); cityVertex(ix*16,CEILING*4,iy*16);
     }
-    inline void drawWall(int ix, int iy, int jx, int jy){
-        glColor3f(0.50f,0.50f,0.50f);
-        glVertex3i(ix*16,0,iy*16); glVertex3i(jx*16,0,jy*16);
-        glVertex3i(jx*16,CEILING,jy*16); glVertex3i(ix*16,CEILING,iy*16);
+    inline void bakeWall(int ix, int iy, int jx, int jy){
+        cityColor(0.50f);
+        cityVertex(ix*16,0,iy*16); cityVertex(jx*16,0,jy*16);
+        cityVertex(jx*16,CEILING,jy*16); cityVertex(ix*16,CEILING,iy*16);
     }
-    inline void drawDoor(int ix, int iy, int jx, int jy){
+    inline void bakeDoor(int ix, int iy, int jx, int jy){
         const int xoff=(ix+ix+ix+jx)*4-ix*16;
         const int yoff=(iy+iy+iy+jy)*4-iy*16;
-        glColor3f(0.50f,0.50f,0.50f);
-        glVertex3i(ix*16,DOORHEIGHT,iy*16);
-        glVertex3i(jx*16,DOORHEIGHT,jy*16);
-        glVertex3i(jx*16,CEILING,jy*16);
-        glVertex3i(ix*16,CEILING,iy*16);
-        glVertex3i(ix*16,0,iy*16);
-        glVertex3i(ix*16+xoff,0,iy*16+yoff);
-        glVertex3i(ix*16+xoff,DOORHEIGHT,iy*16+yoff);
-        glVertex3i(ix*16,DOORHEIGHT,iy*16);
-        glVertex3i(ix*16+xoff*2,0,iy*16+yoff*2);
-        glVertex3i(jx*16,0,jy*16);
-        glVertex3i(jx*16,DOORHEIGHT,jy*16);
-        glVertex3i(ix*16+xoff*2,DOORHEIGHT,iy*16+yoff*2);
+        cityColor(0.50f);
+        cityVertex(ix*16,DOORHEIGHT,iy*16);
+        cityVertex(jx*16,DOORHEIGHT,jy*16);
+        cityVertex(jx*16,CEILING,jy*16);
+        cityVertex(ix*16,CEILING,iy*16);
+        cityVertex(ix*16,0,iy*16);
+        cityVertex(ix*16+xoff,0,iy*16+yoff);
+        cityVertex(ix*16+xoff,DOORHEIGHT,iy*16+yoff);
+        cityVertex(ix*16,DOORHEIGHT,iy*16);
+        cityVertex(ix*16+xoff*2,0,iy*16+yoff*2);
+        cityVertex(jx*16,0,jy*16);
+        cityVertex(jx*16,DOORHEIGHT,jy*16);
+        cityVertex(ix*16+xoff*2,DOORHEIGHT,iy*16+yoff*2);
     }
 
-    int drawBuildings(){
-        glBegin(GL_QUADS);
-        drawHighWall(1,1,1,31);
-        drawHighWall(1,31,31,31);
-        drawHighWall(31,31,31,1);
-        drawHighWall(31,1,1,1);
+    //base and idx are where the arrays start, 0 for the bound buffers
+    void drawCityArrays(const char *base, const GLushort *idx, int n){
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3,GL_SHORT,sizeof(CityVertex),base+offsetof(CityVertex,x));
+        glColorPointer(4,GL_UNSIGNED_BYTE,sizeof(CityVertex),base+offsetof(CityVertex,r));
+        glDrawElements(GL_TRIANGLES,n,GL_UNSIGNED_SHORT,idx);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    void bakeCity(){
+        city.clear();
+        cityfirst[CITY_BORDER]=0;
+        bakeHighWall(1,1,1,31);
+        bakeHighWall(1,31,31,31);
+        bakeHighWall(31,31,31,1);
+        bakeHighWall(31,1,1,1);
+        citycount[CITY_BORDER]=city.size()/4*6;
+        for(int i=0;i<32*32;i++)
+            cityfirst[i]=citycount[i]=0;
         for(int iy=1;iy<31;iy++)
         for(int ix=1;ix<31;ix++){
+            const int first=city.size();
             if(map[iy*32+ix]&INSIDE_BIT){
-                drawRoad(ix,iy,0.30f);
-                drawCeiling(ix,iy);
-                if(map[iy*32+ix]&DOORX_BIT) drawDoor(ix+1,iy,ix+1,iy+1);
-                else drawWall(ix+1,iy,ix+1,iy+1);
-                if(map[iy*32+ix]&DOORZ_BIT) drawDoor(ix,iy+1,ix+1,iy+1);
-                else drawWall(ix,iy+1,ix+1,iy+1);
+                bakeRoad(ix,iy,0.30f);
+                bakeCeiling(ix,iy);
+                if(map[iy*32+ix]&DOORX_BIT) bakeDoor(ix+1,iy,ix+1,iy+1);
+                else bakeWall(ix+1,iy,ix+1,iy+1);
+                if(map[iy*32+ix]&DOORZ_BIT) bakeDoor(ix,iy+1,ix+1,iy+1);
+                else bakeWall(ix,iy+1,ix+1,iy+1);
             }else{
-                drawRoad(ix,iy,0.15f);
+                bakeRoad(ix,iy,0.15f);
                 if(map[iy*32+ix+1]&INSIDE_BIT){
-                    if(map[iy*32+ix]&DOORX_BIT) drawDoor(ix+1,iy,ix+1,iy+1);
-                    else drawWall(ix+1,iy,ix+1,iy+1);
+                    if(map[iy*32+ix]&DOORX_BIT) bakeDoor(ix+1,iy,ix+1,iy+1);
+                    else bakeWall(ix+1,iy,ix+1,iy+1);
                 }
                 if(map[iy*32+ix+32]&INSIDE_BIT){
-                    if(map[iy*32+ix]&DOORZ_BIT) drawDoor(ix,iy+1,ix+1,iy+1);
-                    else drawWall(ix,iy+1,ix+1,iy+1);
+                    if(map[iy*32+ix]&DOORZ_BIT) bakeDoor(ix,iy+1,ix+1,iy+1);
+                    else bakeWall(ix,iy+1,ix+1,iy+1);
                 }
             }
+            cityfirst[iy*32+ix]=first/4*6;
+            citycount[iy*32+ix]=(city.size()-first)/4*6;
+        }
+        //split along the same diagonal gl uses for quads so fog is
+        //interpolated the same, the last vertex of both triangles is the
+        //quad's last which flat shading takes the colour from
+        cityidx.clear();
+        for(size_t q=0;q<city.size();q+=4){
+            cityidx.push_back(q);
+            cityidx.push_back(q+1);
+            cityidx.push_back(q+3);
+            cityidx.push_back(q+1);
+            cityidx.push_back(q+2);
+            cityidx.push_back(q+3);
+        }
+        cityhash=hashMap();
+        citybaked=true;
+
+        switch(citymode){
+        case CITY_VBO:
+            if(!citybuf){
+                genBuffers(1,&citybuf);
+                genBuffers(1,&cityidxbuf);
+            }
+            bindBuffer(GL_ARRAY_BUFFER_ARB,citybuf);
+            bufferData(GL_ARRAY_BUFFER_ARB,city.size()*sizeof(CityVertex),&city[0],GL_STATIC_DRAW_ARB);
+            bindBuffer(GL_ARRAY_BUFFER_ARB,0);
+            break;
+        case CITY_LIST:
+            //a list per cell, so the visible ones go in one glCallLists
+            if(!citybuf)
+                citybuf=glGenLists(CITY_BORDER+1);
+            for(int i=0;i<=CITY_BORDER;i++){
+                glNewList(citybuf+i,GL_COMPILE);
+                if(citycount[i])
+                    drawCityArrays((const char*)&city[0],&cityidx[cityfirst[i]],citycount[i]);
+                glEndList();
+            }
+            break;
+        }
+    }
+
+    //cells drawn this frame. cells outside the view frustum are dropped, and
+    //the rest have to be reached by the range of view angles carried out
+    //from the camera's cell, nearer cells first, through each cell's edges.
+    //walls stop it and doorways narrow it, so indoors this is a portal walk
+    //from room to room and outdoors it shadowcasts the buildings.
+    //zeds, pickups, players and particles are drawn if their cell, or one
+    //their size reaches into, is seen
+    bool occludeon=true; //false when looking from where walls don't hide anything
+    bool cellseen[32*32];
+    float celllo[32*32],cellhi[32*32]; //view angles reaching a cell, 0 is straight ahead
+    float frustum[6][4]; //planes, inside is positive
+    float lookyaw=0.0f;
+    enum{CULL_DRAWN,CULL_FRUSTUM,CULL_HIDDEN};
+    int cellstats[3]; //cells in each state, added up until the next report
+    int entstats[2]; //entities drawn and culled
+    int partstats[2]; //particles drawn and culled
+    const float ANGLE_PAD=0.002f; //keeps rounding from opening cracks
+
+    bool boxInFrustum(float x0, float y0, float z0, float x1, float y1, float z1){
+        for(int p=0;p<6;p++){
+            const float *f=frustum[p];
+            if(f[0]*(f[0]>0?x1:x0)+f[1]*(f[1]>0?y1:y0)+f[2]*(f[2]>0?z1:z0)+f[3]<0)
+                return false;
+        }
+        return true;
+    }
+
+    //planes from the combined projection and modelview, -1 if the view
+    //reaches all the way round so walls can't cut it down by angle
+    int setupFrustum(float *lo, float *hi){
+        float pm[16],mv[16],m[16];
+        glGetFloatv(GL_PROJECTION_MATRIX,pm);
+        glGetFloatv(GL_MODELVIEW_MATRIX,mv);
+        for(int c=0;c<4;c++)
+        for(int r=0;r<4;r++)
+            m[c*4+r]=pm[r]*mv[c*4]+pm[4+r]*mv[c*4+1]+pm[8+r]*mv[c*4+2]+pm[12+r]*mv[c*4+3];
+        for(int p=0;p<6;p++){
+            const int r=p/2;
+            const float sign=p&1?-1.0f:1.0f;
+            for(int k=0;k<4;k++)
+                frustum[p][k]=m[k*4+3]+sign*m[k*4+r];
+        }
+
+        //horizontal spread of the view from its corner rays, these are the
+        //widest when the view is pitched
+        float fx=look.x-cam.x,fy=look.y-cam.y,fz=look.z-cam.z;
+        const float len=sqrtf(fx*fx+fy*fy+fz*fz);
+        if(len<=0.0f)
+            return -1;
+        fx/=len;
+        fy/=len;
+        fz/=len;
+        const float h=sqrtf(fx*fx+fz*fz);
+        if(h<0.01f)
+            return -1;
+        lookyaw=atan2f(fz,fx);
+        const float rx=-fz/h,rz=fx/h; //right
+        const float ux=-fy*fx/h,uz=-fy*fz/h; //horizontal part of up
+        const float tv=tanf(FOV*0.5f*M_PI/180.0f);
+        const float th=tv*WINDOW_W/WINDOW_H;
+        *lo=M_PI;
+        *hi=-M_PI;
+        for(int k=0;k<4;k++){
+            const float sx=k&1?th:-th;
+            const float sy=k&2?tv:-tv;
+            const float dx=fx+rx*sx+ux*sy;
+            const float dz=fz+rz*sx+uz*sy;
+            const float ahead=(dx*fx+dz*fz)/h;
+            if(ahead<=0.0f)
+                return -1;
+            const float a=atan2f((dz*fx-dx*fz)/h,ahead);
+            *lo=min(*lo,a);
+            *hi=max(*hi,a);
         }
-        glEnd();
         return 0;
     }
 
-    int drawZeds(){
-        const float ZEDW=0.80f;
-        const float ZEDW2=0.565685425f;
-        const float HW=0.30;
-        for(int i=0;i<MAX_ZEDS;i++) if(zed[i].state!=Z_NONE){
-            glPushMatrix();
-            glTranslatef(zed[i].p.x,zed[i].p.y,zed[i].p.z);
-            glRotatef(-zed[i].rot*180.0f/M_PI,0.0f,1.0f,0.0f);
-            switch(zed[i].state){
-            case Z_DEAD:
-                glColor3f(0.35f,0.35f,0.35f);
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(-1.4f,0.0f,+ZEDW2);    glVertex3f(+1.4f,0.0f,+ZEDW2);
-                glVertex3f(-1.4f,ZEDW2*2,+ZEDW2); glVertex3f(+1.4f,ZEDW2*2,+ZEDW2);
-                glVertex3f(-1.4f,ZEDW2*2,-ZEDW2); glVertex3f(+1.4f,ZEDW2*2,-ZEDW2);
-                glVertex3f(-1.4f,0.0f,-ZEDW2);    glVertex3f(+1.4f,0.0f,-ZEDW2);
-                glVertex3f(-1.4f,0.0f,+ZEDW2);    glVertex3f(+1.4f,0.0f,+ZEDW2);
-                glEnd();
-                glBegin(GL_QUADS);
-                glVertex3f(-1.4f,0.0f,+ZEDW2);    glVertex3f(-1.4f,ZEDW2*2,+ZEDW2);
-                glVertex3f(-1.4f,ZEDW2*2,-ZEDW2); glVertex3f(-1.4f,0.0f,-ZEDW2);
-                glVertex3f(+1.4f,0.0f,+ZEDW2);    glVertex3f(+1.4f,ZEDW2*2,+ZEDW2);
-                glVertex3f(+1.4f,ZEDW2*2,-ZEDW2); glVertex3f(+1.4f,0.0f,-ZEDW2);
-                glEnd();
-                break;
-            case Z_HEALTH:
-                glColor3f(0.76f,0.76f,0.76f);
-                glScalef(HW,HW,HW);
-                glTranslatef(0.0f,1.0f,0.0f);
-                glBegin(GL_QUADS);
-                glVertex3f(-0.5f,0.0f,+0.5f); glVertex3f(+0.5f,0.0f,+0.5f);
-                glVertex3f(+0.5f,1.0f,+0.5f); glVertex3f(-0.5f,1.0f,+0.5f);
-                glVertex3f(-1.5f,1.0f,+0.5f); glVertex3f(+1.5f,1.0f,+0.5f);
-                glVertex3f(+1.5f,2.0f,+0.5f); glVertex3f(-1.5f,2.0f,+0.5f);
-                glVertex3f(-0.5f,2.0f,+0.5f); glVertex3f(+0.5f,2.0f,+0.5f);
-                glVertex3f(+0.5f,3.0f,+0.5f); glVertex3f(-0.5f,3.0f,+0.5f);
-                glVertex3f(+0.5f,0.0f,-0.5f); glVertex3f(-0.5f,0.0f,-0.5f);
-                glVertex3f(-0.5f,1.0f,-0.5f); glVertex3f(+0.5f,1.0f,-0.5f);
-                glVertex3f(+1.5f,1.0f,-0.5f); glVertex3f(-1.5f,1.0f,-0.5f);
-                glVertex3f(-1.5f,2.0f,-0.5f); glVertex3f(+1.5f,2.0f,-0.5f);
-                glVertex3f(+0.5f,2.0f,-0.5f); glVertex3f(-0.5f,2.0f,-0.5f);
-                glVertex3f(-0.5f,3.0f,-0.5f); glVertex3f(+0.5f,3.0f,-0.5f);
-                glEnd();
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(-0.5f,0.0f,+0.5f); glVertex3f(-0.5f,0.0f,-0.5f);
-                glVertex3f(+0.5f,0.0f,+0.5f); glVertex3f(+0.5f,0.0f,-0.5f);
-                glVertex3f(+0.5f,1.0f,+0.5f); glVertex3f(+0.5f,1.0f,-0.5f);
-                glVertex3f(+1.5f,1.0f,+0.5f); glVertex3f(+1.5f,1.0f,-0.5f);
-                glVertex3f(+1.5f,2.0f,+0.5f); glVertex3f(+1.5f,2.0f,-0.5f);
-                glVertex3f(+0.5f,2.0f,+0.5f); glVertex3f(+0.5f,2.0f,-0.5f);
-                glVertex3f(+0.5f,3.0f,+0.5f); glVertex3f(+0.5f,3.0f,-0.5f);
-                glVertex3f(-0.5f,3.0f,+0.5f); glVertex3f(-0.5f,3.0f,-0.5f);
-                glVertex3f(-0.5f,2.0f,+0.5f); glVertex3f(-0.5f,2.0f,-0.5f);
-                glVertex3f(-1.5f,2.0f,+0.5f); glVertex3f(-1.5f,2.0f,-0.5f);
-                glVertex3f(-1.5f,1.0f,+0.5f); glVertex3f(-1.5f,1.0f,-0.5f);
-                glVertex3f(-0.5f,1.0f,+0.5f); glVertex3f(-0.5f,1.0f,-0.5f);
-                glVertex3f(-0.5f,0.0f,+0.5f); glVertex3f(-0.5f,0.0f,-0.5f);
-                glEnd();
-                break;
-            case Z_AMMO:
-                glColor3f(0.76f,0.76f,0.76f);
-                glScalef(HW,HW,HW);
-                glTranslatef(0.0f,1.0f,0.0f);
-                glBegin(GL_TRIANGLE_STRIP);
-                glVertex3f(-0.5f,3.0f,+0.5f); glVertex3f(+1.5f,1.0f,+0.5f); glVertex3f(-1.5f,2.0f,+0.5f);
-                glVertex3f(+1.5f,0.0f,+0.5f); glVertex3f(+0.5f,0.0f,+0.5f);
-                glEnd();
-                glBegin(GL_TRIANGLE_STRIP);
-                glVertex3f(+1.5f,1.0f,-0.5f); glVertex3f(-0.5f,3.0f,-0.5f); glVertex3f(-1.5f,2.0f,-0.5f);
-                glVertex3f(+1.5f,0.0f,-0.5f); glVertex3f(+0.5f,0.0f,-0.5f);
-                glEnd();
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(-0.5f,3.0f,+0.5f); glVertex3f(-0.5f,3.0f,-0.5f);
-                glVertex3f(+1.5f,1.0f,+0.5f); glVertex3f(+1.5f,1.0f,-0.5f);
-                glVertex3f(+1.5f,0.0f,+0.5f); glVertex3f(+1.5f,0.0f,-0.5f);
-                glVertex3f(+0.5f,0.0f,+0.5f); glVertex3f(+0.5f,0.0f,-0.5f);
-                glVertex3f(-1.5f,2.0f,+0.5f); glVertex3f(-1.5f,2.0f,-0.5f);
-                glVertex3f(-0.5f,3.0f,+0.5f); glVertex3f(-0.5f,3.0f,-0.5f);
-                glEnd();
-                break;
-            default:
-                glColor3f(0.35f,0.35f,0.35f);
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(+ZEDW,2.8f,0.0f);
-                glVertex3f(0.0f,0.0f,+ZEDW); glVertex3f(0.0f,2.8f,+ZEDW);
-                glVertex3f(-ZEDW,0.0f,0.0f); glVertex3f(-ZEDW,2.8f,0.0f);
-                glVertex3f(0.0f,0.0f,-ZEDW); glVertex3f(0.0f,2.8f,-ZEDW);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(+ZEDW,2.8f,0.0f);
-                glEnd();
-                glBegin(GL_QUADS);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(0.0f,0.0f,+ZEDW);
-                glVertex3f(-ZEDW,0.0f,0.0f); glVertex3f(0.0f,0.0f,-ZEDW);
-                glVertex3f(+ZEDW,2.8f,0.0f); glVertex3f(0.0f,2.8f,+ZEDW);
-                glVertex3f(-ZEDW,2.8f,0.0f); glVertex3f(0.0f,2.8f,-ZEDW);
-                glEnd();
-                break;
+    inline float viewAngle(float x, float z){
+        float a=atan2f(z-cam.z,x-cam.x)-lookyaw;
+        if(a>M_PI) a-=2*M_PI;
+        if(a<=-M_PI) a+=2*M_PI;
+        return a;
+    }
+
+    //carries cell c's angles into the neighbour n, through the doorway or
+    //the open edge between them
+    void passEdge(int c, int n){
+        const int lo=c<n?c:n;
+        const int hi=c<n?n:c;
+        const bool xedge=hi-lo==1;
+        float start=0.0f,end=16.0f;
+        if((map[lo]|map[hi])&INSIDE_BIT){
+            if(!(map[lo]&(xedge?DOORX_BIT:DOORZ_BIT)))
+                return;
+            start=4.0f;
+            end=8.0f;
+        }
+        float a0,a1;
+        if(xedge){
+            const float x=(lo%32+1)*16.0f;
+            a0=viewAngle(x,(lo/32)*16.0f+start);
+            a1=viewAngle(x,(lo/32)*16.0f+end);
+        }else{
+            const float z=(lo/32+1)*16.0f;
+            a0=viewAngle((lo%32)*16.0f+start,z);
+            a1=viewAngle((lo%32)*16.0f+end,z);
+        }
+        if(a0>a1)
+            swap(a0,a1);
+        float l=celllo[c],h=cellhi[c];
+        if(a1-a0>M_PI){
+            //the opening goes round behind the camera, only one of its ends
+            //can be in view
+            if(a1-ANGLE_PAD<h) l=max(l,a1-ANGLE_PAD);
+            else if(a0+ANGLE_PAD>l) h=min(h,a0+ANGLE_PAD);
+            else return;
+        }else{
+            l=max(l,a0-ANGLE_PAD);
+            h=min(h,a1+ANGLE_PAD);
+        }
+        if(l>h)
+            return;
+        celllo[n]=min(celllo[n],l);
+        cellhi[n]=max(cellhi[n],h);
+    }
+
+    void updateVisibility(){
+        float lo,hi;
+        occludeon=setupFrustum(&lo,&hi)==0;
+        const int ci=(int)floorf(cam.x/16.0f);
+        const int cj=(int)floorf(cam.z/16.0f);
+        if(ci<1 || ci>30 || cj<1 || cj>30 || cam.y>=CEILING)
+            occludeon=false;
+        for(int i=0;i<32*32;i++){
+            cellseen[i]=false;
+            celllo[i]=M_PI;
+            cellhi[i]=-M_PI;
+        }
+        if(!cullon){
+            for(int iy=1;iy<31;iy++)
+            for(int ix=1;ix<31;ix++)
+                cellseen[iy*32+ix]=true;
+            cellstats[CULL_DRAWN]+=30*30;
+            return;
+        }
+        if(!occludeon){
+            for(int iy=1;iy<31;iy++)
+            for(int ix=1;ix<31;ix++){
+                const int c=iy*32+ix;
+                cellseen[c]=boxInFrustum(ix*16.0f,0.0f,iy*16.0f,ix*16.0f+16.0f,CEILING,iy*16.0f+16.0f);
+                cellstats[cellseen[c]?CULL_DRAWN:CULL_FRUSTUM]++;
             }
-            glPopMatrix();
+            return;
+        }
+
+        //rings of cells further and further from the camera's, each only
+        //passes on outwards so everything feeding a cell comes before it
+        celllo[cj*32+ci]=lo;
+        cellhi[cj*32+ci]=hi;
+        for(int d=0;d<60;d++)
+        for(int di=-d;di<=d;di++)
+        for(int side=0;side<2;side++){
+            const int dj=side?-(d-abs(di)):d-abs(di);
+            if(side && dj==0)
+                continue;
+            const int ix=ci+di;
+            const int iy=cj+dj;
+            if(ix<1 || ix>30 || iy<1 || iy>30)
+                continue;
+            const int c=iy*32+ix;
+            if(celllo[c]>cellhi[c])
+                continue;
+            cellseen[c]=boxInFrustum(ix*16.0f,0.0f,iy*16.0f,ix*16.0f+16.0f,CEILING,iy*16.0f+16.0f);
+            if(di>=0 && ix<30) passEdge(c,c+1);
+            if(di<=0 && ix>1) passEdge(c,c-1);
+            if(dj>=0 && iy<30) passEdge(c,c+32);
+            if(dj<=0 && iy>1) passEdge(c,c-32);
+        }
+        for(int iy=1;iy<31;iy++)
+        for(int ix=1;ix<31;ix++){
+            const int c=iy*32+ix;
+            if(cellseen[c])
+                cellstats[CULL_DRAWN]++;
+            else
+                cellstats[boxInFrustum(ix*16.0f,0.0f,iy*16.0f,ix*16.0f+16.0f,CEILING,iy*16.0f+16.0f)?CULL_HIDDEN:CULL_FRUSTUM]++;
+        }
+    }
+
+    //true if any cell under the square r around x z is seen
+    bool inView(float x, float z, float r){
+        const int x0=max(1,(int)floorf((x-r)/16.0f));
+        const int x1=min(30,(int)floorf((x+r)/16.0f));
+        const int z0=max(1,(int)floorf((z-r)/16.0f));
+        const int z1=min(30,(int)floorf((z+r)/16.0f));
+        for(int iz=z0;iz<=z1;iz++)
+        for(int ix=x0;ix<=x1;ix++)
+            if(cellseen[iz*32+ix])
+                return true;
+        return false;
+    }
+
+    //a cell's walls are on its +x and +z edges, so it is drawn if it or
+    //the neighbour on the other side of one of those is seen
+    inline bool cellDrawn(int c){
+        return cellseen[c] || cellseen[c+1] || cellseen[c+32];
+    }
+
+    //the map is replaced when a world download finishes, so rebake
+    //whenever it no longer hashes the same
+    int drawBuildings(){
+        if(!citybaked || hashMap()!=cityhash)
+            bakeCity();
+        switch(citymode){
+        case CITY_VBO: {
+            cityvis.clear();
+            for(int i=0;i<=CITY_BORDER;i++)
+                if(citycount[i] && (i==CITY_BORDER || cellDrawn(i)))
+                    cityvis.insert(cityvis.end(),&cityidx[cityfirst[i]],&cityidx[cityfirst[i]]+citycount[i]);
+            bindBuffer(GL_ARRAY_BUFFER_ARB,citybuf);
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,cityidxbuf);
+            bufferData(GL_ELEMENT_ARRAY_BUFFER_ARB,cityvis.size()*sizeof(GLushort),&cityvis[0],GL_STREAM_DRAW_ARB);
+            drawCityArrays(NULL,NULL,cityvis.size());
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,0);
+            bindBuffer(GL_ARRAY_BUFFER_ARB,0);
+            } break;
+        case CITY_LIST: {
+            GLushort lists[CITY_BORDER+1];
+            int n=0;
+            for(int i=0;i<=CITY_BORDER;i++)
+                if(citycount[i] && (i==CITY_BORDER || cellDrawn(i)))
+                    lists[n++]=i;
+            glListBase(citybuf);
+            glCallLists(n,GL_UNSIGNED_SHORT,lists);
+            glListBase(0);
+            } break;
+        default:
+            glBegin(GL_TRIANGLES);
+            for(int i=0;i<=CITY_BORDER;i++)
+                if(i==CITY_BORDER || cellDrawn(i))
+                    for(int k=cityfirst[i];k<cityfirst[i]+citycount[i];k++){
+                        const CityVertex &v=city[cityidx[k]];
+                        glColor3ub(v.r,v.g,v.b);
+                        glVertex3s(v.x,v.y,v.z);
+                    }
+            glEnd();
+            break;
         }
         return 0;
     }
 
-    int drawPlayers(){
-        const float ZEDW=0.80f;
+    inline int entityKind(int st){
+        return st==Z_DEAD?ENT_DEAD:st==Z_HEALTH?ENT_HEALTH:st==Z_AMMO?ENT_AMMO:ENT_ZED;
+    }
+
+    //where zed i is drawn, blend of the way through the last tick. one that
+    //jumped was placed by a snapshot or hasn't been ticked since it showed up
+    void blendZed(int i, float *in){
+        const float dx=zed.px[i]-prevzx[i];
+        const float dy=zed.py[i]-prevzy[i];
+        const float dz=zed.pz[i]-prevzz[i];
+        if(dx*dx+dy*dy+dz*dz>blendsnap*blendsnap){
+            in[0]=zed.px[i];
+            in[1]=zed.py[i];
+            in[2]=zed.pz[i];
+            in[3]=zed.rot[i];
+            return;
+        }
+        float dr=zed.rot[i]-prevrot[i];
+        if(dr>M_PI) dr-=M_PI*2;
+        if(dr<-M_PI) dr+=M_PI*2;
+        in[0]=prevzx[i]+dx*blend;
+        in[1]=prevzy[i]+dy*blend;
+        in[2]=prevzz[i]+dz*blend;
+        in[3]=prevrot[i]+dr*blend;
+    }
+
+    //positions and turns of everything in view, grouped by kind
+    int gatherInstances(){
+        const float R=1.5f; //reach of the widest mesh, a corpse
+        for(int k=0;k<ENT_KINDS;k++)
+            instcount[k]=0;
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(inView(zed.px[i],zed.pz[i],R))
+                instcount[entityKind(zed.state[i])]++;
+        }
+        for(int i=0;i<MAX_PLAYERS;i++)
+            if(pl[i].state && i!=plid && inView(pl[i].p.x,pl[i].p.z,R))
+                instcount[ENT_PLAYER]++;
+        int total=0;
+        for(int k=0;k<ENT_KINDS;k++){
+            instfirst[k]=total;
+            total+=instcount[k];
+        }
+
+        int next[ENT_KINDS];
+        int culled=0;
+        for(int k=0;k<ENT_KINDS;k++)
+            next[k]=instfirst[k];
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(!inView(zed.px[i],zed.pz[i],R)){
+                culled++;
+                continue;
+            }
+            blendZed(i,&insts[next[entityKind(zed.state[i])]++*4]);
+        }
         for(int i=0;i<MAX_PLAYERS;i++)
             if(pl[i].state && i!=plid){
+                if(!inView(pl[i].p.x,pl[i].p.z,R)){
+                    culled++;
+                    continue;
+                }
+                float *in=&insts[next[ENT_PLAYER]++*4];
+                in[0]=pl[i].p.x;
+                in[1]=pl[i].p.y;
+                in[2]=pl[i].p.z;
+                in[3]=pl[i].lookr;
+            }
+        entstats[0]+=total;
+        entstats[1]+=culled;
+        return total;
+    }
+
+    void drawInstanced(int total){
+        useProgram(entprog);
+        bindBuffer(GL_ARRAY_BUFFER_ARB,meshbuf);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,meshidxbuf);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3,GL_FLOAT,0,NULL);
+        bindBuffer(GL_ARRAY_BUFFER_ARB,instbuf);
+        bufferData(GL_ARRAY_BUFFER_ARB,total*4*sizeof(float),insts,GL_STREAM_DRAW_ARB);
+        enableVertexAttribArray(INST_ATTRIB);
+        vertexAttribDivisor(INST_ATTRIB,1);
+        for(int k=0;k<ENT_KINDS;k++)
+            if(instcount[k]){
+                glColor3f(entcols[k],entcols[k],entcols[k]);
+                vertexAttribPointer(INST_ATTRIB,4,GL_FLOAT,GL_FALSE,0,
+                    (const GLvoid*)(instfirst[k]*4*sizeof(float)));
+                drawElementsInstanced(GL_TRIANGLES,idxcount[k],GL_UNSIGNED_SHORT,
+                    (const GLvoid*)(idxfirst[k]*sizeof(GLushort)),instcount[k]);
+            }
+        vertexAttribDivisor(INST_ATTRIB,0);
+        disableVertexAttribArray(INST_ATTRIB);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,0);
+        bindBuffer(GL_ARRAY_BUFFER_ARB,0);
+        useProgram(0);
+    }
+
+    //every instance turned and moved into place here, then one draw
+    void drawStreamed(){
+        size_t n=0,ni=0;
+        for(int k=0;k<ENT_KINDS;k++){
+            n+=(size_t)instcount[k]*meshcount[k];
+            ni+=(size_t)instcount[k]*idxcount[k];
+        }
+        if(n==0)
+            return;
+        //kinds differ in indices per vertex, so either can run out first
+        if(entverts.size()<n)
+            entverts.resize(n);
+        if(entidx.size()<ni)
+            entidx.resize(ni);
+        EntityVertex *out=&entverts[0];
+        GLuint *outidx=&entidx[0];
+        GLuint base=0;
+        for(int k=0;k<ENT_KINDS;k++){
+            const GLubyte col=(GLubyte)(entcols[k]*255.0f+0.5f);
+            const float *mesh=&meshes[meshfirst[k]*3];
+            const GLushort *idx=&meshidx[idxfirst[k]];
+            for(int j=0;j<instcount[k];j++){
+                const float *in=&insts[(instfirst[k]+j)*4];
+                const float c=cosf(in[3]);
+                const float s=sinf(in[3]);
+                for(int v=0;v<meshcount[k];v++,out++){
+                    const float *m=&mesh[v*3];
+                    out->x=m[0]*c-m[2]*s+in[0];
+                    out->y=m[1]+in[1];
+                    out->z=m[0]*s+m[2]*c+in[2];
+                    out->r=out->g=out->b=col;
+                    out->a=255;
+                }
+                for(int t=0;t<idxcount[k];t++)
+                    *outidx++=base+idx[t]-meshfirst[k];
+                base+=meshcount[k];
+            }
+        }
+
+        const char *verts=(const char*)&entverts[0];
+        const GLuint *indices=&entidx[0];
+        if(havebuffers){
+            if(!entbuf){
+                genBuffers(1,&entbuf);
+                genBuffers(1,&entidxbuf);
+            }
+            bindBuffer(GL_ARRAY_BUFFER_ARB,entbuf);
+            bufferData(GL_ARRAY_BUFFER_ARB,n*sizeof(EntityVertex),verts,GL_STREAM_DRAW_ARB);
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,entidxbuf);
+            bufferData(GL_ELEMENT_ARRAY_BUFFER_ARB,ni*sizeof(GLuint),indices,GL_STREAM_DRAW_ARB);
+            verts=NULL;
+            indices=NULL;
+        }
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3,GL_FLOAT,sizeof(EntityVertex),verts+offsetof(EntityVertex,x));
+        glColorPointer(4,GL_UNSIGNED_BYTE,sizeof(EntityVertex),verts+offsetof(EntityVertex,r));
+        glDrawElements(GL_TRIANGLES,(GLsizei)ni,GL_UNSIGNED_INT,indices);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        if(havebuffers){
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB,0);
+            bindBuffer(GL_ARRAY_BUFFER_ARB,0);
+        }
+    }
+
+    void drawImmediate(){
+        for(int k=0;k<ENT_KINDS;k++){
+            glColor3f(entcols[k],entcols[k],entcols[k]);
+            for(int j=0;j<instcount[k];j++){
+                const float *in=&insts[(instfirst[k]+j)*4];
                 glPushMatrix();
-                glTranslatef(pl[i].p.x,pl[i].p.y,pl[i].p.z);
-                glRotatef(-pl[i].lookr*180.0f/M_PI,0.0f,1.0f,0.0f);
-
-                glColor3f(0.55f,0.55f,0.55f);
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(+ZEDW,2.8f,0.0f);
-                glVertex3f(0.0f,0.0f,+ZEDW); glVertex3f(0.0f,2.8f,+ZEDW);
-                glVertex3f(-ZEDW,0.0f,0.0f); glVertex3f(-ZEDW,2.8f,0.0f);
-                glVertex3f(0.0f,0.0f,-ZEDW); glVertex3f(0.0f,2.8f,-ZEDW);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(+ZEDW,2.8f,0.0f);
+                glTranslatef(in[0],in[1],in[2]);
+                glRotatef(-in[3]*180.0f/M_PI,0.0f,1.0f,0.0f);
+                glBegin(GL_TRIANGLES);
+                for(int t=0;t<idxcount[k];t++)
+                    glVertex3fv(&meshes[meshidx[idxfirst[k]+t]*3]);
                 glEnd();
-                glBegin(GL_QUADS);
-                glVertex3f(+ZEDW,0.0f,0.0f); glVertex3f(0.0f,0.0f,+ZEDW);
-                glVertex3f(-ZEDW,0.0f,0.0f); glVertex3f(0.0f,0.0f,-ZEDW);
-                glVertex3f(+ZEDW,2.8f,0.0f); glVertex3f(0.0f,2.8f,+ZEDW);
-                glVertex3f(-ZEDW,2.8f,0.0f); glVertex3f(0.0f,2.8f,-ZEDW);
-                glEnd();
-
                 glPopMatrix();
             }
+        }
+    }
+
+    int drawEntities(){
+        const int total=gatherInstances();
+        if(total==0)
+            return 0;
+        switch(entmode){
+        case ENT_INSTANCED:
+            drawInstanced(total);
+            break;
+        case ENT_STREAM:
+            drawStreamed();
+            break;
+        default:
+            drawImmediate();
+            break;
+        }
         return 0;
     }
 
+    //a camera facing square per particle, all written in one pass over the
+    //live run of the ring and drawn with one call
     int drawParticles(){
-	glEnable(GL_CULL_FACE);
-        glColor3f(0.76f,0.76f,0.76f);
-        for(int i=0;i<MAX_PARTICLES;i++)
-            if(particles[i].p.x!=-1){
-                const float x=particles[i].p.x;
-                const float y=particles[i].p.y;
-                const float z=particles[i].p.z;
-                const float S=0.60f*particles[i].age;
-                glBegin(GL_QUAD_STRIP);
-                glVertex3f(x+S,y+S,z+S); glVertex3f(x+S,y-S,z+S); glVertex3f(x+S,y+S,z-S); glVertex3f(x+S,y-S,z-S);
-                glVertex3f(x-S,y+S,z-S); glVertex3f(x-S,y-S,z-S); glVertex3f(x-S,y+S,z+S); glVertex3f(x-S,y-S,z+S);
-                glVertex3f(x+S,y+S,z+S); glVertex3f(x+S,y-S,z+S);
-                glEnd();
-                glBegin(GL_QUADS);
-                glVertex3f(x-S,y-S,z-S); glVertex3f(x+S,y-S,z-S); glVertex3f(x+S,y-S,z+S); glVertex3f(x-S,y-S,z+S);
-                glVertex3f(x-S,y+S,z-S); glVertex3f(x-S,y+S,z+S); glVertex3f(x+S,y+S,z+S); glVertex3f(x+S,y+S,z-S);
-                glEnd();
+        if(particlecount==0)
+            return 0;
+        const size_t need=(size_t)particlecount*4*3;
+        if(partverts.size()<need)
+            partverts.resize(need);
+        float mv[16];
+        glGetFloatv(GL_MODELVIEW_MATRIX,mv);
+        const float rx=mv[0],ry=mv[4],rz=mv[8]; //camera right and up in world space
+        const float ux=mv[1],uy=mv[5],uz=mv[9];
+        float *out=&partverts[0];
+        for(int k=0;k<particlecount;k++){
+            const Particle &pt=particles[(particlefirst+k)&PARTICLE_MASK];
+            if(pt.age<=0)
+                continue;
+            const float S=0.60f*pt.age;
+            if(!inView(pt.p.x,pt.p.z,S)){
+                partstats[1]++;
+                continue;
             }
-	glDisable(GL_CULL_FACE);
+            const float ax=(rx+ux)*S,ay=(ry+uy)*S,az=(rz+uz)*S;
+            const float bx=(rx-ux)*S,by=(ry-uy)*S,bz=(rz-uz)*S;
+            out[0]=pt.p.x-ax; out[1]=pt.p.y-ay; out[2]=pt.p.z-az;
+            out[3]=pt.p.x+bx; out[4]=pt.p.y+by; out[5]=pt.p.z+bz;
+            out[6]=pt.p.x+ax; out[7]=pt.p.y+ay; out[8]=pt.p.z+az;
+            out[9]=pt.p.x-bx; out[10]=pt.p.y-by; out[11]=pt.p.z-bz;
+            out+=12;
+        }
+        const int n=(int)(out-&partverts[0])/3;
+        partstats[0]+=n/4;
+        if(n==0)
+            return 0;
+
+        const float *verts=&partverts[0];
+        if(havebuffers){
+            if(!partbuf)
+                genBuffers(1,&partbuf);
+            bindBuffer(GL_ARRAY_BUFFER_ARB,partbuf);
+            bufferData(GL_ARRAY_BUFFER_ARB,n*3*sizeof(float),verts,GL_STREAM_DRAW_ARB);
+            verts=NULL;
+        }
+        glColor3f(0.76f,0.76f,0.76f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3,GL_FLOAT,0,verts);
+        glDrawArrays(GL_QUADS,0,n);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        if(havebuffers)
+            bindBuffer(GL_ARRAY_BUFFER_ARB,0);
         return 0;
     }
 
     int renderFrame(){
-        if(!isserver && gamestate==0){
+        if(gamestate==0){
             glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
             glMatrixMode(GL_PROJECTION);
             glLoadIdentity();
@@ -1299,11 +1519,11 @@ namespace Game{
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
         gluLookAt(cam.x,cam.y,cam.z,look.x,look.y,look.z,0.0f,1.0f,0.0f);
+        updateVisibility();
 
 	glEnable(GL_DEPTH_TEST);
         drawBuildings();
-        drawZeds();
-        drawPlayers();
+        drawEntities();
         drawParticles();
 	glDisable(GL_DEPTH_TEST);
 
@@ -1344,8 +1564,28 @@ namespace Game{
         glDisable(GL_BLEND);
 
         SDL_GL_SwapBuffers();
+        paceFrame();
         frames++;
 
+        const double now=clockSeconds();
+        if(now-reportstart>=FRAME_REPORT){
+            const int n=frames-reportframes;
+            cout<<"city: "<<citynames[citymode]<<", "<<city.size()/4<<" quads, entities: "
+                <<entnames[entmode]<<", "<<(now-reportstart)*1000/n<<"ms/frame, "
+                <<(ticks-reportticks)/(now-reportstart)<<" ticks/s\n";
+            cout<<"per frame, cells drawn: "<<cellstats[CULL_DRAWN]/n
+                <<" outside view: "<<cellstats[CULL_FRUSTUM]/n
+                <<" behind walls: "<<cellstats[CULL_HIDDEN]/n
+                <<", entities drawn: "<<entstats[0]/n<<" culled: "<<entstats[1]/n
+                <<", particles drawn: "<<partstats[0]/n<<" culled: "<<partstats[1]/n<<"\n";
+            reportstart=now;
+            reportframes=frames;
+            reportticks=ticks;
+            for(int i=0;i<3;i++)
+                cellstats[i]=0;
+            entstats[0]=entstats[1]=partstats[0]=partstats[1]=0;
+        }
+
         //SOIL_save_screenshot(capturefile,SOIL_SAVE_TYPE_TGA,0,0,WINDOW_W,WINDOW_H);
 
         return 0;
@@ -0,0 +1,192 @@
+#include <SDL/SDL_net.h>
+#include <iostream>
+#include <assert.h>
+#include <algorithm>
+#include "net.h"
+using namespace std;
+
+namespace Net{
+
+    UDPpacket **pool=NULL;
+    int freelist[POOL_SIZE]; //pool indices
+    bool isfree[POOL_SIZE];
+    int nfree=0;
+    int allocs=0; //packets allocated since startup
+    int sentpackets=0;
+    int sentbytes=0;
+
+    int initPool(){
+        if(pool)
+            return 0;
+        pool=SDLNet_AllocPacketV(POOL_SIZE,MAX_PACKET);
+        if(!pool){
+            cout<<"SDLNet_AllocPacketV: "<<SDLNet_GetError()<<"\n";
+            return -1;
+        }
+        allocs+=POOL_SIZE;
+        for(int i=0;i<POOL_SIZE;i++){
+            freelist[i]=i;
+            isfree[i]=true;
+        }
+        nfree=POOL_SIZE;
+        return 0;
+    }
+
+    void closePool(){
+        if(pool)
+            SDLNet_FreePacketV(pool);
+        pool=NULL;
+        nfree=0;
+    }
+
+    //-1 if the packet came from the heap
+    int poolIndex(UDPpacket *p){
+        if(!pool)
+            return -1;
+        for(int i=0;i<POOL_SIZE;i++)
+            if(pool[i]==p)
+                return i;
+        return -1;
+    }
+
+    UDPpacket* getPacket(){
+        UDPpacket *p;
+        if(nfree>0){
+            const int i=freelist[--nfree];
+            isfree[i]=false;
+            p=pool[i];
+        }else{
+            //pool exhausted, fall back to the heap
+            p=SDLNet_AllocPacket(MAX_PACKET);
+            if(!p){
+                cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+                return NULL;
+            }
+            allocs++;
+        }
+        p->len=0;
+        return p;
+    }
+
+    void releasePacket(UDPpacket *p){
+        if(!p)
+            return;
+        const int i=poolIndex(p);
+        if(i==-1){
+            SDLNet_FreePacket(p);
+            return;
+        }
+        //a second release would push it twice and overrun the free list
+        assert(!isfree[i]);
+        if(isfree[i])
+            return;
+        isfree[i]=true;
+        freelist[nfree++]=i;
+    }
+
+    int getAllocCount(){
+        return allocs;
+    }
+
+    int sendPacket(UDPsocket sock, int channel, UDPpacket *p){
+        if(!SDLNet_UDP_Send(sock,channel,p)){
+            cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
+            return -1;
+        }
+        sentpackets++;
+        sentbytes+=p->len;
+        return 0;
+    }
+
+    void getSendStats(int *packets, int *bytes){
+        *packets=sentpackets;
+        *bytes=sentbytes;
+    }
+
+    const unsigned char PACK_BITS=0;
+    const unsigned char PACK_RLE=1;
+
+    int packedMapBound(int n){
+        return 1+n;
+    }
+
+    int packBits(const unsigned char *map, int n, unsigned char *out){
+        int len=1;
+        out[0]=PACK_BITS;
+        unsigned int acc=0;
+        int bits=0;
+        for(int i=0;i<n;i++){
+            acc|=(map[i]&7)<<bits;
+            bits+=3;
+            if(bits>=8){
+                out[len++]=acc&0xff;
+                acc>>=8;
+                bits-=8;
+            }
+        }
+        if(bits>0)
+            out[len++]=acc&0xff;
+        return len;
+    }
+
+    //stops early once the runs can't beat limit
+    int packRuns(const unsigned char *map, int n, unsigned char *out, int limit){
+        int len=1;
+        out[0]=PACK_RLE;
+        for(int i=0;i<n && len<limit;){
+            int run=1;
+            while(run<32 && i+run<n && (map[i+run]&7)==(map[i]&7))
+                run++;
+            out[len++]=(map[i]&7)<<5|(run-1);
+            i+=run;
+        }
+        return len;
+    }
+
+    int packMap(const unsigned char *map, int n, unsigned char *out){
+        const int len=packBits(map,n,out);
+        unsigned char *runs=new unsigned char[packedMapBound(n)];
+        const int rlen=packRuns(map,n,runs,len);
+        if(rlen<len)
+            for(int i=0;i<rlen;i++)
+                out[i]=runs[i];
+        delete[] runs;
+        return min(len,rlen);
+    }
+
+    int unpackMap(const unsigned char *in, int len, unsigned char *map, int n){
+        if(len<1)
+            return -1;
+        if(in[0]==PACK_BITS){
+            if(len!=1+(n*3+7)/8)
+                return -1;
+            unsigned int acc=0;
+            int bits=0;
+            int j=1;
+            for(int i=0;i<n;i++){
+                if(bits<3){
+                    acc|=in[j++]<<bits;
+                    bits+=8;
+                }
+                map[i]=acc&7;
+                acc>>=3;
+                bits-=3;
+            }
+            return 0;
+        }
+        if(in[0]==PACK_RLE){
+            int i=0;
+            for(int j=1;j<len;j++){
+                const int run=(in[j]&31)+1;
+                if(i+run>n)
+                    return -1;
+                for(int k=0;k<run;k++)
+                    map[i++]=in[j]>>5;
+            }
+            return i==n?0:-1;
+        }
+        return -1;
+    }
+
+}
+
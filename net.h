@@ -1,17 +1,90 @@
 #ifndef H_NET
 #define H_NET
 
+#include <SDL/SDL_net.h>
+
 namespace Net{
 
     //client->server
     const unsigned char P_UPDATE=2;
     const unsigned char P_GETWORLD=3;
     const unsigned char P_GETCLIENTINFO=4;
+    const unsigned char P_GETCHUNKS=5;
 
     //server->client
     const unsigned char P_WORLD=2;
     const unsigned char P_CLIENTINFO=3;
-    const unsigned char P_PLAYERUPDATE=4;
+    const unsigned char P_SNAPSHOT=5;
+    const unsigned char P_WORLDINFO=6;
+
+    //P_WORLDINFO: [type][w:16][h:16][seed:32][hash:32][size:32], answers P_GETWORLD.
+    //a client that builds a map with the same hash from the seed skips the download,
+    //otherwise it fetches the packed map in chunks of WORLD_CHUNK bytes
+    const int WORLDINFO_SIZE=17;
+    //P_GETCHUNKS: [type][base:16][mask:32]
+    //base is the first missing chunk, bit n of mask is set if base+n is already held.
+    //the server answers with every missing chunk in the window
+    const int GETCHUNKS_SIZE=7;
+    const int WORLD_WINDOW=32;
+    //P_WORLD: [type][chunk:16][packed map bytes]
+    const int WORLD_HEADER=3;
+    const int WORLD_CHUNK=1024;
+
+    //P_CLIENTINFO: [type][id][tickrate:16]
+    const int CLIENTINFO_SIZE=4;
+
+    //P_UPDATE: [type][ackseq:32][ackmask:32][inputs:8] then per input, oldest first
+    //[seq:32][keys][aimr:16][aimp:16][msec]
+    //ackseq is the newest snapshot datagram applied, bit n of ackmask is ackseq-n.
+    //the last few inputs are repeated in every update to ride out packet loss,
+    //and every input made since the last update is sent however many there are
+    const int UPDATE_HEADER=10;
+    const int UPDATE_INPUT=10;
+    const int UPDATE_INPUTS=3;
+    const int MAX_UPDATE_INPUTS=64;
+    const int MAX_INPUT_MSEC=100; //longest movement a single input may carry
+    const int MIN_TICK_RATE=1000/MAX_INPUT_MSEC; //so a tick fits in one input
+
+    //P_SNAPSHOT: [type][tick:32][seq:32][input:32][players:8][zeds:16] then per player
+    //[id][keys][health][ammo][p.xyz v.xyz aimr aimp:16 each]
+    //then per zed [id:16][fields], [state] if bit 4 of fields is set and p.x p.y p.z rot:16
+    //for each of bits 0-3 that is, the others are as the client last had them.
+    //a zed sent as Z_NONE has its fields cleared
+    //input is the recipient's newest input already applied to its player
+    const int SNAPSHOT_HEADER=16;
+    const int SNAPSHOT_PLAYER=20;
+    const int SNAPSHOT_ZED=3; //without its fields
+    const unsigned char ZED_STATE=16;
+    const unsigned char ZED_ALL=31;
+
+    inline int zedFieldBytes(unsigned char fields){
+        int n=fields&ZED_STATE?1:0;
+        for(int k=0;k<4;k++)
+            if(fields&(1<<k))
+                n+=2;
+        return n;
+    }
+
+    //packet pool, allocated once and reused so steady state doesn't hit the heap
+    const int MAX_PACKET=1400;
+    const int POOL_SIZE=16;
+
+    int initPool();
+    void closePool();
+    UDPpacket* getPacket();
+    void releasePacket(UDPpacket *p);
+    int getAllocCount();
+
+    //sends and counts traffic, returns -1 on failure
+    int sendPacket(UDPsocket sock, int channel, UDPpacket *p);
+    void getSendStats(int *packets, int *bytes);
+
+    //map cells only use the low 3 bits, packed maps are whichever is smaller of
+    //3 bits per cell or runs of [value:3][length-1:5] behind a format byte.
+    //packMap returns the packed size, unpackMap -1 if the data doesn't fit n cells
+    int packMap(const unsigned char *map, int n, unsigned char *out);
+    int packedMapBound(int n);
+    int unpackMap(const unsigned char *in, int len, unsigned char *map, int n);
 
 }
 
@@ -0,0 +1,179 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <iostream>
+#include "pool.h"
+using namespace std;
+
+namespace Game{
+
+    const int MAX_TASKS=4096;
+    const int MIN_PARALLEL_TASKS=4; //smaller batches run on the calling thread
+
+    //tasks are taken from the back by the owner and stolen from the front
+    struct TaskQueue{
+        pthread_mutex_t lock;
+        int tasks[MAX_TASKS];
+        int head,tail;
+    };
+
+    int nworkers=1;
+    pthread_t threads[MAX_WORKERS];
+    TaskQueue queues[MAX_WORKERS];
+
+    //a batch is open from when its tasks are queued until runTasks has
+    //them all back. workers only join an open batch they haven't seen, and
+    //runTasks waits for the ones that joined, not for every worker to wake
+    pthread_mutex_t batchlock=PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t batchstart=PTHREAD_COND_INITIALIZER;
+    pthread_cond_t batchdone=PTHREAD_COND_INITIALIZER;
+    unsigned int batch=0; //bumped for every batch
+    bool open=false;
+    int busy=0; //workers inside the open batch
+    unsigned int firstbatch=0; //batch new workers count as seen
+    bool quitting=false;
+    TaskFn taskfn=NULL;
+    void *taskarg=NULL;
+
+    int takeTask(int w){
+        TaskQueue &q=queues[w];
+        pthread_mutex_lock(&q.lock);
+        const int t=q.head<q.tail?q.tasks[--q.tail]:-1;
+        pthread_mutex_unlock(&q.lock);
+        return t;
+    }
+
+    int stealTask(int w){
+        for(int n=1;n<nworkers;n++){
+            TaskQueue &q=queues[(w+n)%nworkers];
+            pthread_mutex_lock(&q.lock);
+            const int t=q.head<q.tail?q.tasks[q.head++]:-1;
+            pthread_mutex_unlock(&q.lock);
+            if(t!=-1)
+                return t;
+        }
+        return -1;
+    }
+
+    //runs tasks until there are none left to take or steal
+    int work(int w, TaskFn fn, void *arg){
+        int done=0;
+        for(;;){
+            int t=takeTask(w);
+            if(t==-1)
+                t=stealTask(w);
+            if(t==-1)
+                break;
+            fn(t,w,arg);
+            done++;
+        }
+        return done;
+    }
+
+    void* workerMain(void *p){
+        const int w=(int)(long)p;
+        pthread_mutex_lock(&batchlock);
+        unsigned int seen=firstbatch;
+        for(;;){
+            while((batch==seen || !open) && !quitting)
+                pthread_cond_wait(&batchstart,&batchlock);
+            if(quitting)
+                break;
+            seen=batch;
+            TaskFn fn=taskfn;
+            void *arg=taskarg;
+            busy++;
+            pthread_mutex_unlock(&batchlock);
+            work(w,fn,arg);
+            pthread_mutex_lock(&batchlock);
+            if(--busy==0)
+                pthread_cond_broadcast(&batchdone);
+        }
+        pthread_mutex_unlock(&batchlock);
+        return NULL;
+    }
+
+    int initWorkers(int n){
+        closeWorkers();
+        if(n<1) n=1;
+        if(n>MAX_WORKERS) n=MAX_WORKERS;
+        for(int w=0;w<n;w++){
+            pthread_mutex_init(&queues[w].lock,NULL);
+            queues[w].head=queues[w].tail=0;
+        }
+        pthread_mutex_lock(&batchlock);
+        quitting=false;
+        firstbatch=batch;
+        pthread_mutex_unlock(&batchlock);
+        int made=1;
+        int ret=0;
+        for(;made<n;made++)
+            if(pthread_create(&threads[made],NULL,workerMain,(void*)(long)made)){
+                cout<<"pthread_create failed, running with "<<made<<" threads\n";
+                ret=-1;
+                break;
+            }
+        //workers only read the count inside a batch, after taking the lock
+        pthread_mutex_lock(&batchlock);
+        nworkers=made;
+        pthread_mutex_unlock(&batchlock);
+        return ret;
+    }
+
+    void closeWorkers(){
+        pthread_mutex_lock(&batchlock);
+        quitting=true;
+        pthread_cond_broadcast(&batchstart);
+        pthread_mutex_unlock(&batchlock);
+        for(int w=1;w<nworkers;w++)
+            pthread_join(threads[w],NULL);
+        nworkers=1;
+    }
+
+    int getWorkerCount(){
+        return nworkers;
+    }
+
+    int getCpuCount(){
+        const long n=sysconf(_SC_NPROCESSORS_ONLN);
+        return n>0?(int)n:1;
+    }
+
+    void runTasks(int ntasks, TaskFn fn, void *arg){
+        if(nworkers==1 || ntasks<MIN_PARALLEL_TASKS || ntasks>MAX_TASKS){
+            for(int t=0;t<ntasks;t++)
+                fn(t,0,arg);
+            return;
+        }
+        //no worker is inside a batch here, so the queues are ours
+        for(int w=0;w<nworkers;w++){
+            pthread_mutex_lock(&queues[w].lock);
+            queues[w].head=queues[w].tail=0;
+        }
+        //first tasks at the back so owners start on them
+        for(int t=ntasks-1;t>=0;t--){
+            TaskQueue &q=queues[t%nworkers];
+            q.tasks[q.tail++]=t;
+        }
+        for(int w=0;w<nworkers;w++)
+            pthread_mutex_unlock(&queues[w].lock);
+
+        pthread_mutex_lock(&batchlock);
+        taskfn=fn;
+        taskarg=arg;
+        batch++;
+        open=true;
+        pthread_cond_broadcast(&batchstart);
+        pthread_mutex_unlock(&batchlock);
+
+        //a worker that is slow to wake has its queue stolen, once this
+        //runs dry every task has been taken and only the ones in hand remain
+        work(0,fn,arg);
+
+        pthread_mutex_lock(&batchlock);
+        open=false;
+        while(busy>0)
+            pthread_cond_wait(&batchdone,&batchlock);
+        pthread_mutex_unlock(&batchlock);
+    }
+
+}
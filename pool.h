@@ -0,0 +1,26 @@
+#ifndef H_POOL
+#define H_POOL
+
+//worker threads for batches of independent tasks. tasks are dealt out
+//round robin and idle workers steal from the others, the calling thread
+//works too and returns once every task is done. small batches just run
+//on the calling thread
+
+namespace Game{
+
+    //worker is 0 for the calling thread and below getWorkerCount() for the
+    //others, for per thread scratch space
+    typedef void (*TaskFn)(int task, int worker, void *arg);
+    const int MAX_WORKERS=64;
+
+    //1 runs everything on the calling thread
+    int initWorkers(int threads);
+    void closeWorkers();
+    int getWorkerCount();
+    int getCpuCount();
+
+    void runTasks(int ntasks, TaskFn fn, void *arg);
+
+}
+
+#endif
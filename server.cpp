@@ -1,112 +1,494 @@
 #include <SDL/SDL_net.h>
 #include <iostream>
-#include "game.h"
+#include <algorithm>
+#include <stdlib.h>
+#include "sim.h"
 #include "net.h"
+#include "pool.h"
 using namespace std;
 using namespace Net;
 
 const int DEFAULT_PORT=8080;
-const int MAX_CLIENTS=8;
+const int DEFAULT_MAX_CLIENTS=64;
+const int DEFAULT_TICK_RATE=60; //simulation ticks per second
+const int SNAPSHOT_INTERVAL=50; //ms between snapshots
+const int STATS_INTERVAL=10000; //ms between tick stats reports
+const int ZED_BUDGET=2400; //bytes of zed updates per client per snapshot
+const int ACK_WINDOW=32; //snapshot datagrams covered by an ack
+const int ZED_HISTORY=4; //records per zed awaiting an ack, a round trip of a few snapshots
+const int INTEREST_RADIUS=6; //cells around a player that can be relevant
+const int MAX_INPUT_BANK=250; //ms of movement a client may have in hand for jitter
+const int MAX_CATCHUP=250; //ms of ticks run in one wake, anything older is dropped
 
 UDPsocket udpsock=NULL;
+SDLNet_SocketSet sockset=NULL;
+int tickrate=DEFAULT_TICK_RATE;
+int maxclients=DEFAULT_MAX_CLIENTS;
+int threads=0; //0 for one per cpu
+Uint32 lastsnapshot=0;
+
+struct TickStats{
+    Uint32 busy,idle; //ms spent working vs blocked on the socket
+    int ticks;
+    int dropped; //ticks skipped after a stall
+    int allocs; //packet allocation count at last report
+    int packets,bytes; //send counts at last report
+    int pickupqueries,pickupscans; //pickup lookups at last report
+    int flowbuilds; //flow field rebuilds at last report
+    int lodupdates,lodfull; //zed updates run and due at full rate at last report
+}stats;
+
+//one zed record sent to a client
+struct ZedRecord{
+    unsigned short v[4];
+    unsigned char state;
+    unsigned char fields; //what it sets on the client
+    Uint32 seq;
+};
+
+//what one client is known to have for one zed. once a record is acked the
+//client has all of it, and only the ones sent after it can have changed
+//anything since
+struct ZedBaseline{
+    unsigned short acked[4];
+    unsigned char ackedstate;
+    unsigned char dirty; //fields the client may have other than acked
+    int nsent;
+    ZedRecord sent[ZED_HISTORY]; //not yet acked, oldest first
+    int heldslot; //index into Client::held, -1 if the client surely has no zed
+};
 
 struct Client{
     IPaddress address;
     int state;
     int lasttime;
-}clients[MAX_CLIENTS];
+    Uint32 seq; //next snapshot datagram
+    Uint32 ackseq,ackmask; //newest datagram the client applied and the ones before it
+    Uint32 inputseq; //newest input applied to the player
+    int inputbank; //ms of movement the client's inputs may still claim
+    Uint32 banktime; //when inputbank was last topped up
+    int zedcursor;
+    ZedBaseline *zeds;
+    int *held; //zed ids the client may have, whatever the server has now
+    int nheld;
+    int viewcell; //cell the relevant set was computed from, -1 if stale
+    bool *relevant; //per map cell
+    int sent,culled; //entities since the last stats report
+}*clients=NULL;
+
+//open addressing from client address to slot, at most half full so probes
+//stay short. -1 marks an empty bucket
+int *clienthash=NULL;
+int hashmask=0;
+int *freeslots=NULL; //unused slots, lowest on top
+int numfree=0;
+int zedvisit[Game::MAX_ZEDS]; //scratch for sendSnapshot
+
+inline int hashAddress(const IPaddress &a){
+    Uint32 h=a.host*2654435761u^a.port*40503u;
+    return (int)((h^(h>>16))&hashmask);
+}
+
+inline bool sameAddress(const IPaddress &a, const IPaddress &b){
+    return a.host==b.host && a.port==b.port;
+}
+
+int findClient(const IPaddress &address){
+    for(int h=hashAddress(address);clienthash[h]!=-1;h=(h+1)&hashmask)
+        if(sameAddress(clients[clienthash[h]].address,address))
+            return clienthash[h];
+    return -1;
+}
+
+void hashClient(int c){
+    int h=hashAddress(clients[c].address);
+    while(clienthash[h]!=-1)
+        h=(h+1)&hashmask;
+    clienthash[h]=c;
+}
 
-int sendWorld(int c, int part){
+//shift later entries of the probe run back so lookups never stop early
+void unhashClient(int c){
+    int h=hashAddress(clients[c].address);
+    while(clienthash[h]!=c)
+        h=(h+1)&hashmask;
+    for(int j=(h+1)&hashmask;clienthash[j]!=-1;j=(j+1)&hashmask){
+        const int home=hashAddress(clients[clienthash[j]].address);
+        //move j into the hole unless its home lies cyclically in (h,j]
+        if(((j-home)&hashmask)>=((j-h)&hashmask)){
+            clienthash[h]=clienthash[j];
+            h=j;
+        }
+    }
+    clienthash[h]=-1;
+}
+
+//the socket isn't bound per client, every send names its address
+int sendToClient(int c, UDPpacket *p){
+    p->address=clients[c].address;
+    return sendPacket(udpsock,-1,p);
+}
+
+//packed once after the map is generated
+unsigned char *world=NULL;
+int worldsize=0;
+int worldchunks=0;
+
+void packWorld(){
+    int w,h;
+    Game::getMapSize(&w,&h);
+    delete[] world;
+    world=new unsigned char[packedMapBound(w*h)];
+    worldsize=packMap(Game::getMap(),w*h,world);
+    worldchunks=(worldsize+WORLD_CHUNK-1)/WORLD_CHUNK;
+    cout<<"world: "<<w*h<<" cells packed to "<<worldsize<<" bytes, "<<worldchunks<<" chunks\n";
+}
+
+int sendWorldInfo(int c){
     if(!udpsock)
         return -1;
-    if(part*256>32*32-256)
-        return 0;
-    unsigned char* map=Game::getMap();
-    if(!map)
-        return -1;
 
-    UDPpacket *p=SDLNet_AllocPacket(258);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
-    p->len=258;
-    p->data[0]=P_WORLD;
-    p->data[1]=part;
-    for(int i=0;i<256;i++)
-        p->data[i+2]=map[part*256+i];
+    int w,h;
+    Game::getMapSize(&w,&h);
+    p->len=WORLDINFO_SIZE;
+    p->data[0]=P_WORLDINFO;
+    SDLNet_Write16(w,&p->data[1]);
+    SDLNet_Write16(h,&p->data[3]);
+    SDLNet_Write32(Game::getMapSeed(),&p->data[5]);
+    SDLNet_Write32(Game::hashMap(),&p->data[9]);
+    SDLNet_Write32(worldsize,&p->data[13]);
+
+    const int ret=sendToClient(c,p);
+    releasePacket(p);
+    return ret;
+}
+
+//every chunk in the window the client doesn't have yet
+int sendWorld(int c, int base, Uint32 mask){
+    if(!udpsock)
+        return -1;
 
-    if(!SDLNet_UDP_Send(udpsock,c,p)){
-        cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
+
+    int ret=0;
+    for(int n=0;n<WORLD_WINDOW && base+n<worldchunks;n++){
+        if((mask>>n)&1)
+            continue;
+        const int start=(base+n)*WORLD_CHUNK;
+        const int len=min(WORLD_CHUNK,worldsize-start);
+        p->data[0]=P_WORLD;
+        SDLNet_Write16(base+n,&p->data[1]);
+        for(int i=0;i<len;i++)
+            p->data[WORLD_HEADER+i]=world[start+i];
+        p->len=WORLD_HEADER+len;
+        if(sendToClient(c,p))
+            ret=-1;
     }
 
-    SDLNet_FreePacket(p);
-    p=NULL;
-    return 0;
+    releasePacket(p);
+    return ret;
 }
 
 int sendClientInfo(int c){
     if(!udpsock)
         return -1;
 
-    UDPpacket *p=SDLNet_AllocPacket(2);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
-    p->len=2;
+    p->len=CLIENTINFO_SIZE;
     p->data[0]=P_CLIENTINFO;
     p->data[1]=c;
+    SDLNet_Write16(tickrate,&p->data[2]);
 
-    if(!SDLNet_UDP_Send(udpsock,c,p)){
-        cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
-        return -1;
+    const int ret=sendToClient(c,p);
+    releasePacket(p);
+    return ret;
+}
+
+//cells potentially visible from anywhere in the player's cell, tested with
+//rays between inset corners of both cells, only redone on cell changes
+void updateRelevance(Client &cl, int c){
+    const float IN=0.5f;
+    const Game::vect &pos=Game::pl[c].p;
+    const int ix=min(max((int)(pos.x/16.0f),1),30);
+    const int iz=min(max((int)(pos.z/16.0f),1),30);
+    if(cl.viewcell==iz*32+ix)
+        return;
+    cl.viewcell=iz*32+ix;
+
+    for(int i=0;i<32*32;i++)
+        cl.relevant[i]=false;
+    const float from[4][2]={{ix*16.0f+IN,iz*16.0f+IN},{ix*16.0f+16.0f-IN,iz*16.0f+IN},
+        {ix*16.0f+IN,iz*16.0f+16.0f-IN},{ix*16.0f+16.0f-IN,iz*16.0f+16.0f-IN}};
+    for(int jz=max(iz-INTEREST_RADIUS,1);jz<=min(iz+INTEREST_RADIUS,30);jz++)
+    for(int jx=max(ix-INTEREST_RADIUS,1);jx<=min(ix+INTEREST_RADIUS,30);jx++){
+        const int dx=jx-ix;
+        const int dz=jz-iz;
+        if(dx*dx+dz*dz>INTEREST_RADIUS*INTEREST_RADIUS)
+            continue;
+        //neighbours are always relevant so nothing pops in at the cell edge
+        if(dx>=-1 && dx<=1 && dz>=-1 && dz<=1){
+            cl.relevant[jz*32+jx]=true;
+            continue;
+        }
+        const float to[5][2]={{jx*16.0f+8.0f,jz*16.0f+8.0f},
+            {jx*16.0f+IN,jz*16.0f+IN},{jx*16.0f+16.0f-IN,jz*16.0f+IN},
+            {jx*16.0f+IN,jz*16.0f+16.0f-IN},{jx*16.0f+16.0f-IN,jz*16.0f+16.0f-IN}};
+        bool vis=false;
+        for(int a=0;a<4 && !vis;a++)
+        for(int b=0;b<5 && !vis;b++)
+            vis=Game::lineOfSight(from[a][0],from[a][1],to[b][0],to[b][1]);
+        cl.relevant[jz*32+jx]=vis;
     }
+}
 
-    SDLNet_FreePacket(p);
-    p=NULL;
-    return 0;
+void beginSnapshot(UDPpacket *p, const Client &cl, Uint32 tick){
+    p->data[0]=P_SNAPSHOT;
+    SDLNet_Write32(tick,&p->data[1]);
+    SDLNet_Write32(cl.seq,&p->data[5]);
+    SDLNet_Write32(cl.inputseq,&p->data[9]);
+    p->data[13]=0;
+    SDLNet_Write16(0,&p->data[14]);
+    p->len=SNAPSHOT_HEADER;
+}
+
+int flushSnapshot(UDPpacket *p, int c, Uint32 tick){
+    const int ret=sendToClient(c,p);
+    clients[c].seq++;
+    beginSnapshot(p,clients[c],tick);
+    return ret;
+}
+
+//1 if the client has the datagram, -1 if it was lost, 0 if we don't know yet
+int ackStatus(const Client &cl, Uint32 seq){
+    const Sint32 d=(Sint32)(cl.ackseq-seq);
+    if(d<0)
+        return (Sint32)(cl.seq-seq)>ACK_WINDOW?-1:0;
+    if(d<ACK_WINDOW)
+        return (cl.ackmask>>d)&1?1:-1;
+    return -1;
+}
+
+inline unsigned char diffFields(const unsigned short *a, unsigned char as, const unsigned short *b, unsigned char bs){
+    unsigned char fields=as!=bs?ZED_STATE:0;
+    for(int k=0;k<4;k++)
+        if(a[k]!=b[k])
+            fields|=1<<k;
+    return fields;
+}
+
+//moves the baseline up to the newest acked record
+void resolveZed(const Client &cl, ZedBaseline &b){
+    int k=b.nsent-1;
+    while(k>=0 && ackStatus(cl,b.sent[k].seq)!=1)
+        k--;
+    if(k<0)
+        return;
+    for(int j=0;j<4;j++)
+        b.acked[j]=b.sent[k].v[j];
+    b.ackedstate=b.sent[k].state;
+    b.dirty=0;
+    for(int j=k+1;j<b.nsent;j++){
+        b.sent[j-k-1]=b.sent[j];
+        b.dirty|=b.sent[j].fields&diffFields(b.acked,b.ackedstate,b.sent[j].v,b.sent[j].state);
+    }
+    b.nsent-=k+1;
+}
+
+//fields of v that differ from what the client is known to have, and the
+//ones a record still in flight may have changed. a removal clears them all
+unsigned char changedFields(const ZedBaseline &b, const unsigned short *v, unsigned char st){
+    if(st==Game::Z_NONE)
+        return ZED_STATE;
+    return b.dirty|diffFields(b.acked,b.ackedstate,v,st);
+}
+
+//the held list is what a snapshot walks besides the live zeds, so a zed
+//stays on it until the client surely has none there
+void updateHeld(Client &cl, int z){
+    ZedBaseline &b=cl.zeds[z];
+    const bool held=b.nsent>0 || b.dirty || b.ackedstate!=Game::Z_NONE;
+    if(held && b.heldslot==-1){
+        b.heldslot=cl.nheld;
+        cl.held[cl.nheld++]=z;
+    }else if(!held && b.heldslot!=-1){
+        const int last=cl.held[--cl.nheld];
+        cl.held[b.heldslot]=last;
+        cl.zeds[last].heldslot=b.heldslot;
+        b.heldslot=-1;
+    }
+}
+
+inline bool sameZed(const unsigned short *a, unsigned char as, const unsigned short *b, unsigned char bs){
+    return as==bs && a[0]==b[0] && a[1]==b[1] && a[2]==b[2] && a[3]==b[3];
+}
+
+void resetBaselines(Client &cl){
+    for(int i=0;i<Game::MAX_ZEDS;i++){
+        ZedBaseline &b=cl.zeds[i];
+        b.acked[0]=b.acked[1]=b.acked[2]=b.acked[3]=0;
+        b.ackedstate=Game::Z_NONE;
+        b.dirty=0;
+        b.nsent=0;
+        b.heldslot=-1;
+    }
+    cl.nheld=0;
+    cl.zedcursor=0;
+    cl.viewcell=-1;
+    cl.sent=cl.culled=0;
+    cl.seq=1;
+    cl.ackseq=0;
+    cl.ackmask=0;
+    cl.inputseq=0;
+    cl.inputbank=0;
+    cl.banktime=SDL_GetTicks();
 }
 
-int sendPlayerUpdates(){
+int sendSnapshot(int c){
     if(!udpsock)
         return -1;
 
-    UDPpacket *p=SDLNet_AllocPacket(21);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
-    for(int i=0;i<MAX_CLIENTS;i++) if(clients[i].state==1){
+    Client &cl=clients[c];
+    const Uint32 tick=Game::getTick();
+    int ret=0;
+    updateRelevance(cl,c);
+    beginSnapshot(p,cl,tick);
+
+    for(int i=0;i<maxclients;i++) if(clients[i].state==1){
         unsigned short pv[8];
         unsigned char kha[3];
         if(Game::getPlayerUpdate(i,&pv[0],&kha[0])==-1)
             continue;
+        //left out, the client drops players it stops hearing about
+        if(i!=c && !cl.relevant[(pv[2]>>11)*32+(pv[0]>>11)]){
+            cl.culled++;
+            continue;
+        }
 
-        p->len=21;
-        p->data[0]=P_PLAYERUPDATE;
-        p->data[1]=(unsigned char)i;
-        p->data[2]=kha[0];
-        p->data[3]=kha[1];
-        p->data[4]=kha[2];
+        //full datagram, flush and continue the same tick in another
+        if(p->len+SNAPSHOT_PLAYER>MAX_PACKET || p->data[13]==255)
+            if(flushSnapshot(p,c,tick))
+                ret=-1;
+
+        unsigned char *d=&p->data[p->len];
+        d[0]=(unsigned char)i;
+        d[1]=kha[0];
+        d[2]=kha[1];
+        d[3]=kha[2];
         for(int j=0;j<8;j++)
-            SDLNet_Write16(pv[j],&p->data[5+j*2]);
+            SDLNet_Write16(pv[j],&d[4+j*2]);
+        p->len+=SNAPSHOT_PLAYER;
+        p->data[13]++;
+        cl.sent++;
+    }
 
-        for(int c=0;c<MAX_CLIENTS;c++) if(clients[c].state==1){
-            if(!SDLNet_UDP_Send(udpsock,c,p)){
-                cout<<"SDLNet_UDP_Send: "<<SDLNet_GetError()<<"\n";
-                continue;
+    //zeds that differ from what the client is known to have, round robin
+    //from where the last snapshot ran out of budget. only live zeds and the
+    //ones the client may still have can differ. zeds outside the relevant
+    //set are sent as removed
+    int nvisit=0;
+    for(int a=0;a<Game::zed.count;a++)
+        zedvisit[nvisit++]=Game::zed.active[a];
+    for(int h=0;h<cl.nheld;h++)
+        if(Game::zed.state[cl.held[h]]==Game::Z_NONE)
+            zedvisit[nvisit++]=cl.held[h];
+    int budget=ZED_BUDGET;
+    int k=nvisit>0?cl.zedcursor%nvisit:0;
+    int skipped=-1;
+    for(int n=0;n<nvisit;n++,k=(k+1)%nvisit){
+        const int z=zedvisit[k];
+        ZedBaseline &b=cl.zeds[z];
+        unsigned short v[4];
+        unsigned char st;
+        Game::getZedUpdate(z,&v[0],&st);
+        if(st!=Game::Z_NONE && !cl.relevant[Game::zed.iz[z]*32+Game::zed.ix[z]]){
+            st=Game::Z_NONE;
+            v[0]=v[1]=v[2]=v[3]=0;
+            cl.culled++;
+        }
+        if(b.nsent>0){
+            resolveZed(cl,b);
+            updateHeld(cl,z);
+        }
+        //wait on the newest record unless it was lost, then anything in
+        //doubt is sent again
+        const ZedRecord &last=b.sent[b.nsent>0?b.nsent-1:0];
+        const bool waiting=b.nsent>0 && ackStatus(cl,last.seq)==0;
+        if(waiting?sameZed(last.v,last.state,v,st):(b.dirty==0 && sameZed(b.acked,b.ackedstate,v,st)))
+            continue;
+        const unsigned char fields=changedFields(b,v,st);
+        const int size=SNAPSHOT_ZED+zedFieldBytes(fields);
+        if(budget<size){
+            if(skipped==-1)
+                skipped=k;
+            continue;
+        }
+
+        if(p->len+size>MAX_PACKET)
+            if(flushSnapshot(p,c,tick))
+                ret=-1;
+
+        unsigned char *d=&p->data[p->len];
+        SDLNet_Write16(z,&d[0]);
+        d[2]=fields;
+        d+=SNAPSHOT_ZED;
+        if(fields&ZED_STATE)
+            *d++=st;
+        for(int j=0;j<4;j++)
+            if(fields&(1<<j)){
+                SDLNet_Write16(v[j],d);
+                d+=2;
             }
+        p->len+=size;
+        SDLNet_Write16(SDLNet_Read16(&p->data[14])+1,&p->data[14]);
+        budget-=size;
+        if(st!=Game::Z_NONE)
+            cl.sent++;
+
+        //the oldest can go, an ack for a newer record supersedes it anyway
+        if(b.nsent==ZED_HISTORY){
+            for(int j=1;j<ZED_HISTORY;j++)
+                b.sent[j-1]=b.sent[j];
+            b.nsent--;
         }
+        ZedRecord &r=b.sent[b.nsent++];
+        for(int j=0;j<4;j++)
+            r.v[j]=v[j];
+        r.state=st;
+        r.fields=st==Game::Z_NONE?ZED_ALL:fields;
+        r.seq=cl.seq;
+        b.dirty|=r.fields&diffFields(b.acked,b.ackedstate,v,st);
+        updateHeld(cl,z);
     }
+    if(skipped!=-1)
+        cl.zedcursor=skipped;
 
-    SDLNet_FreePacket(p);
-    p=NULL;
-    return 0;
+    if(p->len>SNAPSHOT_HEADER)
+        if(flushSnapshot(p,c,tick))
+            ret=-1;
+
+    releasePacket(p);
+    return ret;
+}
+
+int sendSnapshots(){
+    int ret=0;
+    for(int c=0;c<maxclients;c++) if(clients[c].state==1)
+        if(sendSnapshot(c))
+            ret=-1;
+    return ret;
 }
 
 
@@ -119,6 +501,8 @@ int initServer(int port){
         cout<<"SDLNet_Init: "<<SDLNet_GetError()<<"\n";
         return -1;
     }
+    if(initPool())
+        return -1;
 
     udpsock=SDLNet_UDP_Open(port);
     if(!udpsock){
@@ -126,38 +510,85 @@ int initServer(int port){
         return -1;
     }
 
-    for(int i=0;i<MAX_CLIENTS;i++)
+    sockset=SDLNet_AllocSocketSet(1);
+    if(!sockset){
+        cout<<"SDLNet_AllocSocketSet: "<<SDLNet_GetError()<<"\n";
+        return -1;
+    }
+    if(SDLNet_UDP_AddSocket(sockset,udpsock)==-1){
+        cout<<"SDLNet_UDP_AddSocket: "<<SDLNet_GetError()<<"\n";
+        return -1;
+    }
+
+    //per client state is allocated when a slot is first used
+    clients=new Client[maxclients];
+    for(int i=0;i<maxclients;i++){
         clients[i].state=0;
+        clients[i].zeds=NULL;
+        clients[i].held=NULL;
+        clients[i].relevant=NULL;
+    }
+    int size=1;
+    while(size<maxclients*2)
+        size*=2;
+    clienthash=new int[size];
+    hashmask=size-1;
+    for(int i=0;i<size;i++)
+        clienthash[i]=-1;
+    freeslots=new int[maxclients];
+    numfree=0;
+    for(int i=maxclients-1;i>=0;i--)
+        freeslots[numfree++]=i;
 
     return 0;
 }
 
 void closeServer(){
+    for(int i=0;i<maxclients;i++){
+        delete[] clients[i].zeds;
+        delete[] clients[i].held;
+        delete[] clients[i].relevant;
+    }
+    delete[] clients;
+    clients=NULL;
+    delete[] clienthash;
+    clienthash=NULL;
+    delete[] freeslots;
+    freeslots=NULL;
+    delete[] world;
+    world=NULL;
+    SDLNet_FreeSocketSet(sockset);
+    sockset=NULL;
     SDLNet_UDP_Close(udpsock);
     udpsock=NULL;
+    closePool();
+    Game::closeWorkers();
     SDLNet_Quit();
     SDL_Quit();
 }
 
 int connectClient(IPaddress address){
-    for(int i=0;i<MAX_CLIENTS;i++)
-        if(clients[i].state==0){
-            if(SDLNet_UDP_Bind(udpsock,i,&address)==-1){
-                cout<<"SDLNet_UDP_Bind: "<<SDLNet_GetError()<<"\n";
-                return -1;
-            }
-            clients[i].address=address;
-            clients[i].state=2;
-            clients[i].lasttime=SDL_GetTicks();
-            cout<<"client connected\n";
-            return i;
-        }
-    return -1;
+    if(numfree==0)
+        return -1;
+    const int i=freeslots[--numfree];
+    if(!clients[i].zeds){
+        clients[i].zeds=new ZedBaseline[Game::MAX_ZEDS];
+        clients[i].held=new int[Game::MAX_ZEDS];
+        clients[i].relevant=new bool[32*32];
+    }
+    clients[i].address=address;
+    clients[i].state=2;
+    clients[i].lasttime=SDL_GetTicks();
+    resetBaselines(clients[i]);
+    hashClient(i);
+    cout<<"client connected\n";
+    return i;
 }
 
 void disconnectClient(int c){
     if(clients[c].state){
-        SDLNet_UDP_Unbind(udpsock,c);
+        unhashClient(c);
+        freeslots[numfree++]=c;
         clients[c].state=0;
         Game::removePlayer(c);
         cout<<"client disconnected\n";
@@ -168,21 +599,58 @@ void processPacket(UDPpacket *p, int i){
     if(p->len<1)
         return;
     switch(p->data[0]){
-    case P_UPDATE:
-        if(p->len<6)
+    case P_UPDATE: {
+        if(p->len<UPDATE_HEADER)
             break;
-        Game::setKeys(i,p->data[1]);
-        Game::setAim(i,SDLNet_Read16(&p->data[2]),SDLNet_Read16(&p->data[4]));
-        break;
+        const int n=p->data[9];
+        if(p->len<UPDATE_HEADER+n*UPDATE_INPUT)
+            break;
+        const Uint32 ackseq=SDLNet_Read32(&p->data[1]);
+        if((Sint32)(ackseq-clients[i].ackseq)>=0){
+            clients[i].ackseq=ackseq;
+            clients[i].ackmask=SDLNet_Read32(&p->data[5]);
+        }
+        if(clients[i].state!=1)
+            break;
+        //inputs can only claim the time that has passed here, or a client
+        //could send as many as it liked and move at any speed
+        const Uint32 now=SDL_GetTicks();
+        clients[i].inputbank=min(clients[i].inputbank+(int)(now-clients[i].banktime),MAX_INPUT_BANK);
+        clients[i].banktime=now;
+        //inputs overlap between updates, only run the ones we haven't seen
+        const unsigned char *d=&p->data[UPDATE_HEADER];
+        for(int j=0;j<n;j++,d+=UPDATE_INPUT){
+            Game::Input in;
+            in.seq=SDLNet_Read32(&d[0]);
+            if((Sint32)(in.seq-clients[i].inputseq)<=0)
+                continue;
+            in.keys=d[4];
+            in.aimr=SDLNet_Read16(&d[5]);
+            in.aimp=SDLNet_Read16(&d[7]);
+            in.msec=min(min((int)d[9],MAX_INPUT_MSEC),clients[i].inputbank);
+            clients[i].inputbank-=in.msec;
+            Game::setKeys(i,in.keys);
+            Game::setAim(i,in.aimr,in.aimp);
+            Game::movePlayer(i,in);
+            clients[i].inputseq=in.seq;
+        }
+        } break;
     case P_GETWORLD:
-        if(p->len<2)
+        if(clients[i].state!=2)
+            break;
+        sendWorldInfo(i);
+        break;
+    case P_GETCHUNKS:
+        if(p->len<GETCHUNKS_SIZE)
             break;
         if(clients[i].state!=2)
             break;
-        sendWorld(i,p->data[1]);
+        sendWorld(i,SDLNet_Read16(&p->data[1]),SDLNet_Read32(&p->data[3]));
         break;
     case P_GETCLIENTINFO:
         clients[i].state=1;
+        clients[i].inputbank=0;
+        clients[i].banktime=SDL_GetTicks();
         Game::respawnPlayer(i);
         sendClientInfo(i);
         break;
@@ -194,18 +662,13 @@ void processPacket(UDPpacket *p, int i){
 int updateServer(){
     const int NOW=SDL_GetTicks();
 
-    UDPpacket *p=SDLNet_AllocPacket(1024);
-    if(!p){
-        cout<<"SDLNet_AllocPacket: "<<SDLNet_GetError()<<"\n";
+    UDPpacket *p=getPacket();
+    if(!p)
         return -1;
-    }
 
     while(SDLNet_UDP_Recv(udpsock,p)>0){
-        int i=0;
-        while(i<MAX_CLIENTS && !(clients[i].state && clients[i].address.host==p->address.host
-            && clients[i].address.port==p->address.port))
-            i++;
-        if(i>=MAX_CLIENTS){
+        int i=findClient(p->address);
+        if(i==-1){
             if((i=connectClient(p->address))!=-1)
                 processPacket(p,i);
         }else{
@@ -214,35 +677,137 @@ int updateServer(){
         }
     }
 
-    SDLNet_FreePacket(p);
-    p=NULL;
+    releasePacket(p);
 
-    for(int i=0;i<MAX_CLIENTS;i++){
-        if(clients[i].lasttime<NOW-5000)
+    for(int i=0;i<maxclients;i++){
+        if(clients[i].state && clients[i].lasttime<NOW-5000)
             disconnectClient(i);
     }
 
-    static int lasttick=NOW;
-    if(lasttick<NOW-50){
-        sendPlayerUpdates();
-        lasttick=NOW;
+    if(NOW-lastsnapshot>=(Uint32)SNAPSHOT_INTERVAL){
+        sendSnapshots();
+        lastsnapshot=NOW;
     }
 
     return 0;
 }
 
-int main(){
+void reportStats(){
+    if(stats.ticks>0)
+        cout<<"ticks: "<<stats.ticks
+            <<" busy: "<<stats.busy*1000/stats.ticks<<"us/tick"
+            <<" idle: "<<stats.idle*1000/stats.ticks<<"us/tick"
+            <<" load: "<<stats.busy*100/max(stats.busy+stats.idle,(Uint32)1)<<"%"
+            <<" packet allocs: "<<getAllocCount()-stats.allocs<<"\n";
+    if(stats.dropped>0)
+        cout<<"dropped: "<<stats.dropped<<" ticks behind\n";
+    int packets,bytes;
+    getSendStats(&packets,&bytes);
+    cout<<"sent: "<<packets-stats.packets<<" packets "<<bytes-stats.bytes<<" bytes\n";
+    stats.packets=packets;
+    stats.bytes=bytes;
+    int queries,scanned;
+    Game::getPickupStats(&queries,&scanned);
+    if(queries>stats.pickupqueries)
+        cout<<"pickup queries: "<<queries-stats.pickupqueries
+            <<" scanned: "<<(float)(scanned-stats.pickupscans)/(queries-stats.pickupqueries)<<"/query\n";
+    stats.pickupqueries=queries;
+    stats.pickupscans=scanned;
+    int bands[Game::LOD_BANDS+1],updates,full;
+    Game::getLodStats(bands,&updates,&full);
+    if(full>stats.lodfull){
+        cout<<"zeds by lod band:";
+        for(int b=0;b<=Game::LOD_BANDS;b++)
+            cout<<" "<<bands[b];
+        cout<<" updates run: "<<100*(updates-stats.lodupdates)/(full-stats.lodfull)<<"%\n";
+    }
+    stats.lodupdates=updates;
+    stats.lodfull=full;
+    const int builds=Game::getFlowBuilds();
+    if(builds>stats.flowbuilds)
+        cout<<"flow field rebuilds: "<<builds-stats.flowbuilds<<"\n";
+    stats.flowbuilds=builds;
+    for(int c=0;c<maxclients;c++) if(clients[c].state==1){
+        cout<<"client "<<c<<": entities sent: "<<clients[c].sent<<" culled: "<<clients[c].culled<<"\n";
+        clients[c].sent=clients[c].culled=0;
+    }
+    stats.allocs=getAllocCount();
+    stats.busy=stats.idle=0;
+    stats.ticks=0;
+    stats.dropped=0;
+}
+
+int main(int argc, char** argv){
+    if(argc>1)
+        tickrate=atoi(argv[1]);
+    if(tickrate<MIN_TICK_RATE || tickrate>1000){
+        cout<<"tick rate must be between "<<MIN_TICK_RATE<<" and 1000\n";
+        return 0;
+    }
+    if(argc>2)
+        maxclients=atoi(argv[2]);
+    if(maxclients<1 || maxclients>Game::MAX_PLAYERS){
+        cout<<"max clients must be between 1 and "<<Game::MAX_PLAYERS<<"\n";
+        return 0;
+    }
+    if(argc>3)
+        threads=atoi(argv[3]);
+    if(threads<1)
+        threads=Game::getCpuCount();
     if(initServer(DEFAULT_PORT))
         return 0;
     Game::initServer();
-    cout<<"server started\n";
-
+    Game::setThreads(threads);
+    packWorld();
+    cout<<"server started, "<<tickrate<<" ticks/s, "<<maxclients<<" clients max, "
+        <<Game::getWorkerCount()<<" threads\n";
+
+    Uint32 start=SDL_GetTicks();
+    const int maxcatchup=max(tickrate*MAX_CATCHUP/1000,1);
+    Uint32 ticks=0;
+    Uint32 laststats=start;
+    lastsnapshot=start;
+    stats.allocs=getAllocCount();
+    getSendStats(&stats.packets,&stats.bytes);
     for(;;){
+        //sleep on the socket until a packet arrives or the next deadline
+        Uint32 now=SDL_GetTicks();
+        const Uint32 nexttick=start+(Uint32)((ticks+1)*1000.0/tickrate);
+        Uint32 deadline=min(nexttick,lastsnapshot+SNAPSHOT_INTERVAL);
+        if((Sint32)(deadline-now)>0){
+            if(SDLNet_CheckSockets(sockset,deadline-now)==-1){
+                cout<<"SDLNet_CheckSockets: "<<SDLNet_GetError()<<"\n";
+                break;
+            }
+            const Uint32 woke=SDL_GetTicks();
+            stats.idle+=woke-now;
+            now=woke;
+        }
+
         if(updateServer())
             break;
-        Game::updateFrame();
+        //catch up in fixed steps so the simulation doesn't depend on loop timing,
+        //after a stall the backlog is dropped rather than run back to back
+        for(int n=0;SDL_GetTicks()-start>=(Uint32)((ticks+1)*1000.0/tickrate);n++){
+            if(n==maxcatchup){
+                const Uint32 behind=SDL_GetTicks()-start-(Uint32)(ticks*1000.0/tickrate);
+                stats.dropped+=(int)(behind*tickrate/1000);
+                start+=behind;
+                break;
+            }
+            Game::step(1.0f/tickrate);
+            ticks++;
+            stats.ticks++;
+        }
+        const Uint32 done=SDL_GetTicks();
+        stats.busy+=done-now;
+
+        if(done-laststats>=(Uint32)STATS_INTERVAL){
+            reportStats();
+            laststats=done;
+        }
     }
 
+    closeServer();
     return 0;
 }
-
@@ -0,0 +1,1408 @@
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <math.h>
+#include "MersenneTwister.h"
+#include "sim.h"
+#include "simd.h"
+#include "pool.h"
+#include "slots.h"
+
+using namespace std;
+
+namespace Game{
+
+    bool isserver=false;
+    int plid=-1;
+    unsigned int tick=0; //steps taken since resetWorld
+    MTRand rng;
+    char *map=NULL;
+    unsigned long mapseed=0;
+    int *cols=NULL;
+    int *pickups=NULL; //per cell lists of pickups, linked like cols
+    //the other broadphase, zeds sorted by cell once a tick. cell c holds
+    //cellzeds[cellstart[c]] up to cellstart[c+1]
+    bool sortedgrid=false;
+    int cellstart[32*32+1];
+    int cellzeds[MAX_ZEDS];
+    int pickupqueries=0,pickupscans=0;
+    bool flowstale=true; //map changed since the flow field was built
+
+    Player pl[MAX_PLAYERS];
+    int numplayers=0;
+    Zeds zed;
+    Bullet bullets[MAX_BULLETS];
+    Particle particles[MAX_PARTICLES];
+    int particlefirst=0;
+    int particlecount=0;
+    Slots<MAX_ZEDS> zedslots;
+    Slots<MAX_BULLETS> bulletslots;
+
+    void seed(unsigned long s){
+        rng.seed(s);
+    }
+
+    void setKeys(int i, unsigned char keys){
+        if(pl[i].state)
+            pl[i].keys=keys;
+    }
+
+    void setAim(int i, unsigned short aimr, unsigned short aimp){
+        if(pl[i].state){
+            pl[i].lookr=(float)aimr*M_PI*2.0f/65536.0f;
+            pl[i].lookp=(float)aimp*M_PI/65536.0f-M_PI*0.5f;
+            if(pl[i].lookr>M_PI*2) pl[i].lookr-=M_PI*2;
+            if(pl[i].lookr<0) pl[i].lookr+=M_PI*2;
+            if(pl[i].lookp>0.49f*M_PI) pl[i].lookp=0.49f*M_PI;
+            if(pl[i].lookp<-0.49f*M_PI) pl[i].lookp=-0.49f*M_PI;
+        }
+    }
+
+    unsigned short getAimr(int i){
+        return (unsigned short)(pl[i].lookr*65536.0f/(M_PI*2.0f));
+    }
+
+    unsigned short getAimp(int i){
+        return (unsigned short)((pl[i].lookp+M_PI*0.5f)*65536.0f/M_PI);
+    }
+
+    unsigned char* getMap(){
+        return (unsigned char*)map;
+    }
+
+    void getMapSize(int *w, int *h){
+        *w=32;
+        *h=32;
+    }
+
+    //fnv-1a over the cells
+    unsigned int hashMap(){
+        unsigned int h=2166136261u;
+        if(map)
+            for(int i=0;i<32*32;i++){
+                h^=(unsigned char)map[i];
+                h*=16777619u;
+            }
+        return h;
+    }
+
+    unsigned long getMapSeed(){
+        return mapseed;
+    }
+
+    int getPlayerUpdate(int i, unsigned short *pv, unsigned char* kha){
+        if(i<0 || i>=MAX_PLAYERS || pl[i].state==0)
+            return -1;
+        pv[0]=(unsigned short)(pl[i].p.x*65536.0f/512.0f);
+        pv[1]=(unsigned short)(pl[i].p.y*65536.0f/512.0f);
+        pv[2]=(unsigned short)(pl[i].p.z*65536.0f/512.0f);
+        pv[3]=(signed short)(pl[i].v.x*4.0f);
+        pv[4]=(signed short)(pl[i].v.y*4.0f);
+        pv[5]=(signed short)(pl[i].v.z*4.0f);
+        pv[6]=getAimr(i);
+        pv[7]=getAimp(i);
+        kha[0]=pl[i].keys;
+        kha[1]=(signed char)pl[i].health;
+        kha[2]=(signed char)pl[i].ammo;
+        return 0;
+    }
+
+    int setPlayerUpdate(int i, const unsigned short *pv, const unsigned char* kha){
+        if(i<0 || i>=MAX_PLAYERS)
+            return -1;
+        pl[i].p.set(
+        ((float)pv[0])*512.0f/65536.0f,
+        ((float)pv[1])*512.0f/65536.0f,
+        ((float)pv[2])*512.0f/65536.0f);
+        pl[i].v.set(
+        ((float)((signed short)pv[3]))/4.0f,
+        ((float)((signed short)pv[4]))/4.0f,
+        ((float)((signed short)pv[5]))/4.0f);
+        if(i!=plid){
+            setAim(i,pv[6],pv[7]);
+            pl[i].keys=kha[0];
+        }
+        pl[i].health=(signed char)kha[1];
+        pl[i].ammo=(signed char)kha[2];
+        pl[i].state=1;
+        return 0;
+    }
+
+    void respawnPlayer(int p){
+        pl[p].p.set(248.0f,0.0f,248.0f);
+        pl[p].v.set(0.0f,0.0f,0.0f);
+        pl[p].lookr=0.0f;
+        pl[p].lookp=0.0f;
+        pl[p].shootdelay=0.5f;
+        pl[p].health=100;
+        pl[p].ammo=30;
+        pl[p].onground=true;
+        pl[p].keys=0;
+        pl[p].state=1;
+    }
+
+    void removePlayer(int p){
+        pl[p].p.set(0.0f,0.0f,0.0f);
+        pl[p].v.set(0.0f,0.0f,0.0f);
+        pl[p].keys=0;
+        pl[p].state=0;
+    }
+
+    void resetWorld(){
+        isserver=false;
+        tick=0;
+        if(map) delete[] map;
+        map=new char[32*32];
+        if(cols) delete[] cols;
+        cols=new int[32*32];
+        if(pickups) delete[] pickups;
+        pickups=new int[32*32];
+        //clear
+        for(int i=0;i<32*32;i++)
+            map[i]=0;
+        for(int i=0;i<32*32;i++)
+            cols[i]=pickups[i]=-1;
+        for(int i=0;i<=32*32;i++)
+            cellstart[i]=0;
+        for(int i=0;i<MAX_ZEDS;i++){
+            zed.state[i]=Z_NONE;
+            zed.slot[i]=-1;
+            zed.walk[i]=0.0f;
+        }
+        zed.count=0;
+        zed.top=0;
+        zedslots.reset();
+        bulletslots.reset();
+        particlefirst=particlecount=0;
+
+        for(int i=0;i<MAX_BULLETS;i++)
+            bullets[i].p.x=-1;
+        for(int i=0;i<MAX_PLAYERS;i++)
+            pl[i].state=0;
+    }
+
+    void generateMap(unsigned long s){
+        MTRand rng(s); //own generator, nothing else drawn affects the layout
+        mapseed=s;
+        flowstale=true;
+        for(int i=0;i<32*32;i++)
+            map[i]=0;
+
+        //buildings
+        for(int c=3;c>0;--c){
+            for(int iy=1;iy<31;iy++)
+            for(int ix=1;ix<31;ix++){
+                if(iy!=13 && ix!=13 && rng.randInt(1)){
+                    const int i=iy*32+ix;
+                    if(map[i-32]&&map[i+32] || map[i-1]&&map[i+1]
+                        || map[i-33]&&!map[i-32]&&!map[i-1]
+                        || map[i-31]&&!map[i-32]&&!map[i+1]
+                        || map[i+31]&&!map[i+32]&&!map[i-1]
+                        || map[i+33]&&!map[i+32]&&!map[i+1])
+                        continue;
+                    map[i]=INSIDE_BIT;
+                }
+            }
+        }
+        //doorways
+        for(int iy=1;iy<31;iy++)
+        for(int ix=1;ix<31;ix++){
+            const int i=iy*32+ix;
+            if(map[i]&INSIDE_BIT){
+                switch(rng.randInt(3)){
+                case 0: map[i]|=DOORX_BIT; break;
+                case 1: map[i]|=DOORZ_BIT; break;
+                case 2: map[i-1]|=DOORX_BIT; break;
+                case 3: map[i-32]|=DOORZ_BIT; break;
+                }
+                if(rng.rand()<0.20)
+                    switch(rng.randInt(3)){
+                    case 0: map[i]|=DOORX_BIT; break;
+                    case 1: map[i]|=DOORZ_BIT; break;
+                    case 2: map[i-1]|=DOORX_BIT; break;
+                    case 3: map[i-32]|=DOORZ_BIT; break;
+                    }
+            }
+        }
+    }
+
+    //corpses lie along their heading, the living stand diagonally
+    void cacheZedOBB(const int i){
+        const float ZEDW2=0.565685425f;
+        const bool dead=zed.state[i]==Z_DEAD;
+        const float r=dead?-zed.rot[i]:-zed.rot[i]-M_PI/4;
+        zed.obbc[i]=cosf(r);
+        zed.obbs[i]=sinf(r);
+        zed.obbex[i]=dead?1.4f:ZEDW2;
+        zed.obbey[i]=dead?ZEDW2:1.4f;
+        zed.obbez[i]=ZEDW2;
+    }
+
+    inline bool isPickup(const unsigned char s){
+        return s==Z_HEALTH || s==Z_AMMO;
+    }
+
+    //pickups don't move, they go in their cell's list once placed
+    void linkPickup(const int i){
+        const int c=(int)(zed.pz[i]/16.0f)*32+(int)(zed.px[i]/16.0f);
+        zed.ix[i]=c%32;
+        zed.iz[i]=c/32;
+        zed.cprev[i]=-1;
+        zed.cnext[i]=pickups[c];
+        if(zed.cnext[i]!=-1)
+            zed.cprev[zed.cnext[i]]=i;
+        pickups[c]=i;
+    }
+
+    void unlinkPickup(const int i){
+        if(zed.cnext[i]!=-1)
+            zed.cprev[zed.cnext[i]]=zed.cprev[i];
+        if(zed.cprev[i]!=-1)
+            zed.cnext[zed.cprev[i]]=zed.cnext[i];
+        else
+            pickups[zed.iz[i]*32+zed.ix[i]]=zed.cnext[i];
+        zed.cprev[i]=-1;
+        zed.cnext[i]=-1;
+    }
+
+    //every change to or from Z_NONE goes through here to keep the active list.
+    //a pickup leaves its cell list here too, whatever it turns into
+    void setZedState(const int i, const unsigned char s){
+        if(isPickup(zed.state[i]))
+            unlinkPickup(i);
+        if(zed.state[i]==Z_NONE && s!=Z_NONE){
+            zed.slot[i]=zed.count;
+            zed.active[zed.count++]=i;
+            if(i>=zed.top)
+                zed.top=i+1;
+            zed.rnd[i]=rng.randInt();
+            zedslots.take(i);
+        }else if(zed.state[i]!=Z_NONE && s==Z_NONE){
+            const int last=zed.active[--zed.count];
+            zed.active[zed.slot[i]]=last;
+            zed.slot[last]=zed.slot[i];
+            zed.slot[i]=-1;
+            zedslots.release(i);
+        }
+        zed.state[i]=s;
+        zed.walk[i]=s==Z_WANDERING || s==Z_ATTACKING?1.0f:0.0f;
+        while(zed.top>0 && zed.state[zed.top-1]==Z_NONE)
+            zed.top--;
+        cacheZedOBB(i);
+    }
+
+    inline void turnZed(const int i, const float r){
+        zed.rot[i]=r;
+        zed.dirx[i]=cosf(r);
+        zed.dirz[i]=sinf(r);
+        cacheZedOBB(i);
+    }
+
+    int initServer(){
+        plid=-1;
+        resetWorld();
+        isserver=true;
+        generateMap(rng.randInt());
+
+        //ammo+health caches
+        for(int iz=1;iz<31;iz++)
+        for(int ix=1;ix<31;ix++)
+            if(map[iz*32+ix]&INSIDE_BIT && rng()<0.125f){
+                const unsigned char type=rng()<0.25f?Z_HEALTH:Z_AMMO;
+                const int s=rng.randInt(2)+rng.randInt(2);
+                const float posx=ix*16.0f+8.0f-(float)s*0.5f;
+                const float posz=iz*16.0f+8.0f-(float)s*0.5f;
+                for(int jz=0;jz<s;jz++)
+                for(int jx=0;jx<s;jx++){
+                    const int c=zedslots.alloc();
+                    if(c==-1)
+                        break;
+                    setZedState(c,type);
+                    zed.px[c]=posx+jx;
+                    zed.py[c]=0.0f;
+                    zed.pz[c]=posz+jz;
+                    zed.vx[c]=zed.vy[c]=zed.vz[c]=0.0f;
+                    turnZed(c,0.0f);
+                    linkPickup(c);
+                }
+            }
+        //zeds
+/*
+        for(int iz=1;iz<31;iz++)
+        for(int ix=1;ix<31;ix++){
+            if(abs(ix-15)+abs(iz-15)<3)
+                continue;
+            spawnZed(ix*16.0f+8.0f,iz*16.0f+8.0f,rng()*M_PI*2);
+        }
+*/
+
+        return 0;
+    }
+
+    inline float sqr(float x){ return x*x; }
+
+    //remove zed from its cell list, no-op if it isn't linked (pickups)
+    void unlinkZed(const int i){
+        if(sortedgrid)
+            return;
+        if(zed.cprev[i]==-1 && cols[zed.iz[i]*32+zed.ix[i]]!=i)
+            return;
+        if(zed.cnext[i]!=-1)
+            zed.cprev[zed.cnext[i]]=zed.cprev[i];
+        if(zed.cprev[i]!=-1)
+            zed.cnext[zed.cprev[i]]=zed.cnext[i];
+        else
+            cols[zed.iz[i]*32+zed.ix[i]]=zed.cnext[i];
+        zed.cprev[i]=-1;
+        zed.cnext[i]=-1;
+    }
+
+    void linkZed(const int i){
+        const int ix=zed.px[i]/16.0f;
+        const int iz=zed.pz[i]/16.0f;
+        zed.ix[i]=ix;
+        zed.iz[i]=iz;
+        if(sortedgrid) //picked up on the next sort
+            return;
+        zed.cprev[i]=-1;
+        zed.cnext[i]=cols[iz*32+ix];
+        if(zed.cnext[i]!=-1)
+            zed.cprev[zed.cnext[i]]=i;
+        cols[iz*32+ix]=i;
+    }
+
+    void updateColInfo(const int i){
+        if(sortedgrid)
+            return;
+        const int ix=zed.px[i]/16.0f;
+        const int iz=zed.pz[i]/16.0f;
+        if(zed.ix[i]!=ix || zed.iz[i]!=iz){
+            unlinkZed(i);
+            linkZed(i);
+        }
+    }
+
+    inline bool isLinked(const unsigned char s){
+        return s!=Z_NONE && !isPickup(s);
+    }
+
+    //counting sort of everything linked by cell, in active list order
+    void sortGrid(){
+        for(int c=0;c<=32*32;c++)
+            cellstart[c]=0;
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(!isLinked(zed.state[i]))
+                continue;
+            zed.ix[i]=zed.px[i]/16.0f;
+            zed.iz[i]=zed.pz[i]/16.0f;
+            cellstart[zed.iz[i]*32+zed.ix[i]+1]++;
+        }
+        for(int c=0;c<32*32;c++)
+            cellstart[c+1]+=cellstart[c];
+        int fill[32*32];
+        for(int c=0;c<32*32;c++)
+            fill[c]=cellstart[c];
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(isLinked(zed.state[i]))
+                cellzeds[fill[zed.iz[i]*32+zed.ix[i]]++]=i;
+        }
+    }
+
+    void setSortedGrid(bool on){
+        if(on==sortedgrid)
+            return;
+        sortedgrid=on;
+        if(on){
+            sortGrid();
+            return;
+        }
+        //back to lists, relink everything where it stands now
+        for(int c=0;c<32*32;c++)
+            cols[c]=-1;
+        for(int a=0;a<zed.count;a++)
+            if(isLinked(zed.state[zed.active[a]]))
+                linkZed(zed.active[a]);
+    }
+
+    bool getSortedGrid(){
+        return sortedgrid;
+    }
+
+    //zeds in one cell from whichever broadphase is in use. the sorted grid
+    //can still hold zeds removed since the sort, those are skipped
+    struct CellZeds{
+        int c,k,end;
+        CellZeds(const int cell):c(-1),k(0),end(0){
+            if(sortedgrid){
+                k=cellstart[cell]-1;
+                end=cellstart[cell+1];
+                next();
+            }else
+                c=cols[cell];
+        }
+        void next(){
+            if(!sortedgrid){
+                c=zed.cnext[c];
+                return;
+            }
+            do{
+                c=++k<end?cellzeds[k]:-1;
+            }while(c!=-1 && zed.state[c]==Z_NONE);
+        }
+    };
+
+    //wandering zed in a free slot, -1 if full
+    int spawnZed(float x, float z, float rot){
+        const int i=zedslots.alloc();
+        if(i==-1)
+            return -1;
+        setZedState(i,Z_WANDERING);
+        zed.px[i]=x;
+        zed.py[i]=0.0f;
+        zed.pz[i]=z;
+        zed.vx[i]=zed.vy[i]=zed.vz[i]=0.0f;
+        turnZed(i,rot);
+        linkZed(i);
+        return i;
+    }
+
+    unsigned int getZedHandle(int i){
+        return zedslots.handle(i);
+    }
+
+    int findZed(unsigned int h){
+        return zedslots.get(h);
+    }
+
+    void makeZedOBB(OBB* b, const int c){
+        b->p.set(zed.px[c],zed.py[c]+zed.obbey[c],zed.pz[c]);
+        b->e.set(zed.obbex[c],zed.obbey[c],zed.obbez[c]);
+        b->ax.set(zed.obbc[c],0.0f,-zed.obbs[c]);
+        b->ay.set(0.0f,1.0f,0.0f);
+        b->az.set(zed.obbs[c],0.0f,zed.obbc[c]);
+    }
+
+    inline void addZedBox(Boxes& b, const int c){
+        const int j=b.n++;
+        b.px[j]=zed.px[c];
+        b.py[j]=zed.py[c]+zed.obbey[c];
+        b.pz[j]=zed.pz[c];
+        b.c[j]=zed.obbc[c];
+        b.s[j]=zed.obbs[c];
+        b.ex[j]=zed.obbex[c];
+        b.ey[j]=zed.obbey[c];
+        b.ez[j]=zed.obbez[c];
+        b.id[j]=c;
+    }
+
+    bool intersectionOBB(const OBB& a, const OBB& b){
+        vect t(b.p);
+        a.wtol(t);
+        //rotation matrix
+        vect rx(dot(a.ax,b.ax),dot(a.ax,b.ay),dot(a.ax,b.az));
+        vect ry(dot(a.ay,b.ax),dot(a.ay,b.ay),dot(a.ay,b.az));
+        vect rz(dot(a.az,b.ax),dot(a.az,b.ay),dot(a.az,b.az));
+        //a's basis vectors
+        if(fabs(t.x) > a.e.x+b.e.x*fabs(rx.x)+b.e.y*fabs(rx.y)+b.e.z*fabs(rx.z)) return false;
+        if(fabs(t.y) > a.e.y+b.e.x*fabs(ry.x)+b.e.y*fabs(ry.y)+b.e.z*fabs(ry.z)) return false;
+        if(fabs(t.z) > a.e.z+b.e.x*fabs(rz.x)+b.e.y*fabs(rz.y)+b.e.z*fabs(rz.z)) return false;
+        //b's basis vectors
+        if(fabs(t.x*rx.x+t.y*ry.x+t.z*rz.x) > b.e.x
+        + a.e.x*fabs(rx.x)+a.e.y*fabs(ry.x)+a.e.z*fabs(rz.x)) return false;
+        if(fabs(t.x*rx.y+t.y*ry.y+t.z*rz.y) > b.e.y
+        + a.e.x*fabs(rx.y)+a.e.y*fabs(ry.y)+a.e.z*fabs(rz.y)) return false;
+        if(fabs(t.x*rx.z+t.y*ry.z+t.z*rz.z) > b.e.z
+        + a.e.x*fabs(rx.z)+a.e.y*fabs(ry.z)+a.e.z*fabs(rz.z)) return false;
+        //9 cross products
+        if(fabs(t.z*ry.x-t.y*rz.x) > a.e.y*fabs(rz.x)+a.e.z*fabs(ry.x)
+        + b.e.y*fabs(rx.z)+b.e.z*fabs(rx.y)) return false;
+        if(fabs(t.z*ry.y-t.y*rz.y) > a.e.y*fabs(rz.y)+a.e.z*fabs(ry.y)
+        + b.e.x*fabs(rx.z)+b.e.z*fabs(rx.x)) return false;
+        if(fabs(t.z*ry.z-t.y*rz.z) > a.e.y*fabs(rz.z)+a.e.z*fabs(ry.z)
+        + b.e.x*fabs(rx.y)+b.e.y*fabs(rx.x)) return false;
+        if(fabs(t.x*rz.x-t.z*rx.x) > a.e.x*fabs(rz.x)+a.e.z*fabs(rx.x)
+        + b.e.y*fabs(ry.z)+b.e.z*fabs(ry.y)) return false;
+        if(fabs(t.x*rz.y-t.z*rx.y) > a.e.x*fabs(rz.y)+a.e.z*fabs(rx.y)
+        + b.e.x*fabs(ry.z)+b.e.z*fabs(ry.x)) return false;
+        if(fabs(t.x*rz.z-t.z*rx.z) > a.e.x*fabs(rz.z)+a.e.z*fabs(rx.z)
+        + b.e.x*fabs(ry.y)+b.e.y*fabs(ry.x)) return false;
+        if(fabs(t.y*rx.x-t.x*ry.x) > a.e.x*fabs(ry.x)+a.e.y*fabs(rx.x)
+        + b.e.y*fabs(rz.z)+b.e.z*fabs(rz.y)) return false;
+        if(fabs(t.y*rx.y-t.x*ry.y) > a.e.x*fabs(ry.y)+a.e.y*fabs(rx.y)
+        + b.e.x*fabs(rz.z)+b.e.z*fabs(rz.x)) return false;
+        if(fabs(t.y*rx.z-t.x*ry.z) > a.e.x*fabs(ry.z)+a.e.y*fabs(rx.z)
+        + b.e.x*fabs(rz.y)+b.e.y*fabs(rz.x)) return false;
+        return true;
+    }
+
+    void collideWalls(const int i, const float offx, const float offz, float& x, float& z, const float rad);
+
+    //returns max of 0-none, 1-wall, 2-side of block, 3-zed
+    int collideCharacter(const int me, bool isplayer, float& x, float& y, float& z, const float rad){
+        int ret=0;
+        if(x<16.0f+rad){ x=16.0f+rad; ret=1; }
+        if(z<16.0f+rad){ z=16.0f+rad; ret=1; }
+        if(x>31.0f*16.0f-rad){ x=31.0f*16.0f-rad; ret=1; }
+        if(z>31.0f*16.0f-rad){ z=31.0f*16.0f-rad; ret=1; }
+        const int ix=x/16.0f;
+        const int iz=z/16.0f;
+        const int i=iz*32+ix;
+        const float offx=x-ix*16.0f;
+        const float offz=z-iz*16.0f;
+        //zeds
+        const int jx=offx<8.0f?ix-1:ix+1;
+        const int jz=offz<8.0f?iz-1:iz+1;
+        const int cs[4]={iz*32+ix,iz*32+jx,jz*32+ix,jz*32+jx};
+        for(int ic=0;ic<4;ic++)
+            for(CellZeds it(cs[ic]);it.c!=-1;it.next()){
+                const int c=it.c;
+                if(!isplayer && c==me)
+                    continue;
+                if(zed.state[c]==Z_DEAD){
+                    //upright-obb-upright-cylinder test
+                    OBB b;
+                    makeZedOBB(&b,c);
+                    vect p(x,y,z);
+                    b.wtol(p);
+                    if(!(p.y<-2.8f || p.y>b.e.y)){
+                        bool ontop=p.y>b.e.y-0.3f;
+                        bool hit=false;
+                        if(fabs(p.x)<b.e.x){
+                            if(fabs(p.z)<b.e.z+rad){
+                                hit=true;
+                                if(!ontop){
+                                    p.z=p.z>0?(b.e.z+rad+0.001f):-(b.e.z+rad+0.001f);
+                                    b.ltow(p); x=p.x; z=p.z;
+                                }
+                            }
+                        }else if(fabs(p.z)<b.e.z){
+                            if(fabs(p.x)<b.e.x+rad){
+                                hit=true;
+                                if(!ontop){
+                                    p.x=p.x>0?(b.e.x+rad+0.001f):-(b.e.x+rad+0.001f);
+                                    b.ltow(p); x=p.x; z=p.z;
+                                }
+                            }
+                        }else if(sqr(fabs(p.x)-b.e.x)+sqr(fabs(p.z)-b.e.z)<rad*rad){
+                            hit=true;
+                            if(!ontop){
+                                const float ddx=p.x>0?(p.x-b.e.x):(p.x+b.e.x);
+                                const float ddz=p.z>0?(p.z-b.e.z):(p.z+b.e.z);
+                                const float dist=sqrtf(ddx*ddx+ddz*ddz);
+                                p.x+=(rad-dist+0.001f)*ddx/dist;
+                                p.z+=(rad-dist+0.001f)*ddz/dist;
+                                b.ltow(p); x=p.x; z=p.z;
+                            }
+                        }
+                        if(hit && ontop){
+                            if(isplayer){
+                                if(pl[me].v.y<0){
+                                    p.y=b.e.y; b.ltow(p);
+                                    pl[me].p.y=p.y;
+                                    pl[me].v.y=0;
+                                }
+                                pl[me].onground=true;
+                            }else{
+                                if(zed.vy[me]<0){
+                                    p.y=b.e.y; b.ltow(p);
+                                    zed.py[me]=p.y;
+                                    zed.vy[me]=0;
+                                }
+                            }
+                        }else if(hit)
+                            if(ret<2) ret=2;
+                    }
+                }else if(sqr(x-zed.px[c])+sqr(z-zed.pz[c])<2.56f && y+2.8f<zed.py[c] && zed.py[c]+2.8f<y){
+                    const float dist=sqrtf(sqr(x-zed.px[c])+sqr(z-zed.pz[c]));
+                    x+=(1.60f-dist)*(x-zed.px[c])/dist;
+                    z+=(1.60f-dist)*(z-zed.pz[c])/dist;
+                    ret=3;
+                }
+            }
+        const float lastx=x;
+        const float lastz=z;
+        collideWalls(i,offx,offz,x,z,rad);
+        if(!isplayer)
+            updateColInfo(me);
+        if(ret<1 && x!=lastx || z!=lastz)
+            ret=1;
+        return ret;
+    }
+
+    //pushes out of the walls around cell i, offx and offz place x and z in it
+    void collideWalls(const int i, const float offx, const float offz, float& x, float& z, const float rad){
+        if(offx<rad){
+            if( (map[i]&INSIDE_BIT || map[i-1]&INSIDE_BIT)
+                && !(map[i-1]&DOORX_BIT && offz>4+rad && offz<8-rad) )
+                x+=rad-offx;
+        }else if(offx>16.0f-rad){
+            if( (map[i]&INSIDE_BIT || map[i+1]&INSIDE_BIT)
+                && !(map[i]&DOORX_BIT && offz>4+rad && offz<8-rad) )
+                x+=16.0f-rad-offx;
+        }
+        if(offz<rad){
+            if( (map[i]&INSIDE_BIT || map[i-32]&INSIDE_BIT)
+                && !(map[i-32]&DOORZ_BIT && offx>4+rad && offx<8-rad) )
+                z+=rad-offz;
+        }else if(offz>16.0f-rad){
+            if( (map[i]&INSIDE_BIT || map[i+32]&INSIDE_BIT)
+                && !(map[i]&DOORZ_BIT && offx>4+rad && offx<8-rad) )
+                z+=16.0f-rad-offz;
+        }
+    }
+
+    inline float abs(float x){ return x>0?x:-x; }
+
+    int collideLine(float x, float y, float z, float dx, float dy, float dz){
+        //>=0 on zed collision, -1 on NO collision, -2 otherwise
+        if(x<16.0f || x>31.0f*16.0f || z<16.0f || z>31.0f*16.0f || y<0.0f || y>48.0f)
+            return -2;
+        const int ix=x/16.0f;
+        const int iz=z/16.0f;
+        const int ix2=(x+dx)/16.0f;
+        const int iz2=(z+dz)/16.0f;
+        const float offx=x-ix*16.0f;
+        const float offz=z-iz*16.0f;
+        const float halfdx=dx*0.5f;
+        const float halfdy=dy*0.5f;
+        const float halfdz=dz*0.5f;
+        if(ix2!=ix || iz2!=iz){
+            //across block edge
+            if(abs(ix-ix2)+abs(iz-iz2)>1){
+                int r=collideLine(x,y,z,halfdx,halfdy,halfdz);
+                if(r!=-1)
+                    return r;
+                return collideLine(x+halfdx,y+halfdy,z+halfdz,halfdx,halfdy,halfdz);
+            }
+            float p,px,py,pz;
+            if(ix2-ix){
+                if(!(map[iz*32+ix]&INSIDE_BIT || map[iz*32+ix2]&INSIDE_BIT))
+                    goto nowallhit;
+                px=max(ix,ix2)*16.0f;
+                p=(px-x)/dx;
+                pz=z+dz*p;
+                py=y+dy*p;
+                if(py<6.0f && map[iz*32+min(ix,ix2)]&DOORX_BIT){
+                    const float offz=pz-iz*16.0f;
+                    if(offz>4.0f && offz<8.0f)
+                        goto nowallhit;
+                }
+            }else{
+                if(!(map[iz*32+ix]&INSIDE_BIT || map[iz2*32+ix]&INSIDE_BIT))
+                    goto nowallhit;
+                pz=max(iz,iz2)*16.0f;
+                p=(pz-z)/dz;
+                px=x+dx*p;
+                py=y+dy*p;
+                if(py<6.0f && map[min(iz,iz2)*32+ix]&DOORZ_BIT){
+                    const float offx=px-ix*16.0f;
+                    if(offx>4.0f && offx<8.0f)
+                        goto nowallhit;
+                }
+            }
+            if(py>15.0f) //ceiling
+                return -1;
+            return -2; //wall hit
+        }
+        nowallhit:
+        const int jx2=offx<8.0f?ix2-1:ix2+1;
+        const int jz2=offz<8.0f?iz2-1:iz2+1;
+        const int cs[4]={iz2*32+ix2,iz2*32+jx2,jz2*32+ix2,jz2*32+jx2};
+        //const float maxdistsq=sqr(sqrt(halfdx*halfdx+halfdy*halfdy+halfdz*halfdz)+0.80f);
+        //obb-segment tests against the candidates in batches, in list order
+        //so the first zed hit is the same as testing them one by one
+        const float p1[3]={x,y,z};
+        const float p2[3]={x+halfdx,y+halfdy,z+halfdz};
+        Boxes b;
+        b.n=0;
+        for(int ic=0;ic<4;ic++)
+            for(CellZeds it(cs[ic]);it.c!=-1;it.next()){
+                addZedBox(b,it.c);
+                if(b.n==BOX_BATCH){
+                    const int j=segmentVsBoxes(p1,p2,b);
+                    if(j!=-1)
+                        return b.id[j];
+                    b.n=0;
+                }
+            }
+        if(b.n>0){
+            const int j=segmentVsBoxes(p1,p2,b);
+            if(j!=-1)
+                return b.id[j];
+        }
+        return -1;
+    }
+
+    //true if the edge between two adjacent cells is a wall
+    inline bool wallBetween(const int a, const int b){
+        const int lo=a<b?a:b;
+        const int hi=a<b?b:a;
+        if(!((map[lo]|map[hi])&INSIDE_BIT))
+            return false;
+        return !(map[lo]&(hi-lo==1?DOORX_BIT:DOORZ_BIT));
+    }
+
+    //2d line of sight over the building grid, doorways count as open
+    bool lineOfSight(float x0, float z0, float x1, float z1){
+        int ix=x0/16.0f;
+        int iz=z0/16.0f;
+        const int ix1=x1/16.0f;
+        const int iz1=z1/16.0f;
+        const float dx=x1-x0;
+        const float dz=z1-z0;
+        const int sx=dx>0?1:-1;
+        const int sz=dz>0?1:-1;
+        //distance along the line to the next x and z edges, and between edges
+        const float tdx=dx!=0?16.0f/fabs(dx):1e30f;
+        const float tdz=dz!=0?16.0f/fabs(dz):1e30f;
+        float tx=dx!=0?(sx>0?(ix+1)*16.0f-x0:x0-ix*16.0f)/fabs(dx):1e30f;
+        float tz=dz!=0?(sz>0?(iz+1)*16.0f-z0:z0-iz*16.0f)/fabs(dz):1e30f;
+        while(ix!=ix1 || iz!=iz1){
+            if(ix<1 || ix>30 || iz<1 || iz>30)
+                break;
+            const int i=iz*32+ix;
+            if(tx<tz){
+                if(tx>1.0f)
+                    break;
+                if(wallBetween(i,i+sx))
+                    return false;
+                ix+=sx;
+                tx+=tdx;
+            }else{
+                if(tz>1.0f)
+                    break;
+                if(wallBetween(i,i+sz*32))
+                    return false;
+                iz+=sz;
+                tz+=tdz;
+            }
+        }
+        return true;
+    }
+
+    //the oldest particle makes way when the ring is full
+    Particle& newParticle(){
+        if(particlecount==MAX_PARTICLES){
+            particlefirst=(particlefirst+1)&PARTICLE_MASK;
+            particlecount--;
+        }
+        return particles[(particlefirst+particlecount++)&PARTICLE_MASK];
+    }
+
+    void hitZed(const int i){
+        if(zed.state[i]==Z_DEAD){
+            /*const float RAD=0.80f;
+            for(int count=0;count<12;count++){
+                Particle &gib=newParticle();
+                gib.p.x=zed.px[i]+rng.rand(RAD*2)-RAD;
+                gib.p.y=zed.py[i]+rng.rand(2.8f);
+                gib.p.z=zed.pz[i]+rng.rand(RAD*2)-RAD;
+                gib.age=rng.rand(0.20f)+0.20f;
+            }*/
+            unlinkZed(i);
+            setZedState(i,Z_NONE);
+        }else{
+            setZedState(i,Z_DEAD);
+        }
+    }
+
+    //quantized like player updates, pickup spin is left to the client
+    int getZedUpdate(int i, unsigned short *v, unsigned char *state){
+        if(i<0 || i>=MAX_ZEDS)
+            return -1;
+        *state=zed.state[i];
+        if(zed.state[i]==Z_NONE){
+            v[0]=v[1]=v[2]=v[3]=0;
+            return 0;
+        }
+        v[0]=(unsigned short)(zed.px[i]*65536.0f/512.0f);
+        v[1]=(unsigned short)(zed.py[i]*65536.0f/512.0f);
+        v[2]=(unsigned short)(zed.pz[i]*65536.0f/512.0f);
+        if(zed.state[i]==Z_HEALTH || zed.state[i]==Z_AMMO){
+            v[3]=0;
+        }else{
+            float r=fmodf(zed.rot[i],M_PI*2);
+            if(r<0) r+=M_PI*2;
+            v[3]=(unsigned short)(r*65536.0f/(M_PI*2.0f));
+        }
+        return 0;
+    }
+
+    int setZedUpdate(int i, const unsigned short *v, unsigned char state){
+        if(i<0 || i>=MAX_ZEDS)
+            return -1;
+        const bool linked=zed.state[i]!=Z_NONE && zed.state[i]!=Z_HEALTH && zed.state[i]!=Z_AMMO;
+        const bool pickup=zed.state[i]==Z_HEALTH || zed.state[i]==Z_AMMO;
+        if(linked)
+            unlinkZed(i);
+        setZedState(i,state);
+        if(state==Z_NONE)
+            return 0;
+        zed.px[i]=((float)v[0])*512.0f/65536.0f;
+        zed.py[i]=((float)v[1])*512.0f/65536.0f;
+        zed.pz[i]=((float)v[2])*512.0f/65536.0f;
+        zed.vx[i]=zed.vy[i]=zed.vz[i]=0.0f;
+        if(state==Z_HEALTH || state==Z_AMMO){
+            if(!pickup)
+                turnZed(i,0.0f);
+            linkPickup(i);
+        }else{
+            turnZed(i,(float)v[3]*M_PI*2.0f/65536.0f);
+            linkZed(i);
+        }
+        return 0;
+    }
+
+    const float GRAVITY=30.0f;
+    const float WALK_SPEED=10.0f;
+    const float JUMP_SPEED=10.0f;
+    const float CLIMB_SPEED=3.0f;
+    const float BULLET_SPEED=70.0f;
+    const float SHOOT_DELAY=0.20f;
+    const float PARTICLE_AGE=0.10f;
+    const float PARTICLE_INTERVAL=1.0f;
+    const float PL_RAD=0.80f;
+    const float ZED_RANGE=32.0f;
+    const int ZED_DAMAGE=30;
+
+    int setThreads(const int n){
+        return initWorkers(n);
+    }
+
+    unsigned int getTick(){
+        return tick;
+    }
+
+    //first pickup of a wanted kind in reach of x,z. pickups sit near their
+    //cell's middle so the cell and the three nearest neighbours cover it
+    int findPickup(const float x, const float z, const bool health, const bool ammo){
+        const int ix=x/16.0f;
+        const int iz=z/16.0f;
+        const int jx=x-ix*16.0f<8.0f?ix-1:ix+1;
+        const int jz=z-iz*16.0f<8.0f?iz-1:iz+1;
+        const int cs[4]={iz*32+ix,iz*32+jx,jz*32+ix,jz*32+jx};
+        pickupqueries++;
+        for(int ic=0;ic<4;ic++)
+            for(int i=pickups[cs[ic]];i!=-1;i=zed.cnext[i]){
+                pickupscans++;
+                if(sqr(x-zed.px[i])+sqr(z-zed.pz[i])<PL_RAD*PL_RAD*4
+                    && (zed.state[i]==Z_HEALTH?health:ammo))
+                    return i;
+            }
+        return -1;
+    }
+
+    void getPickupStats(int *queries, int *scanned){
+        *queries=pickupqueries;
+        *scanned=pickupscans;
+    }
+
+    //player movement for one input, the server runs it as inputs arrive and
+    //the client runs the same inputs to predict and replay its own player
+    void movePlayer(int p, const Input& in){
+        const float t=(float)in.msec/1000.0f;
+        if(!pl[p].state || t<=0)
+            return;
+        const float lookr=(float)in.aimr*M_PI*2.0f/65536.0f;
+        float dirx=0;
+        float diry=0;
+        if(in.keys&KB_FORWARD) diry+=1.0f;
+        if(in.keys&KB_LEFT) dirx-=1.0f;
+        if(in.keys&KB_BACK) diry-=1.0f;
+        if(in.keys&KB_RIGHT) dirx+=1.0f;
+        if(dirx!=0 && diry!=0){
+            dirx*=0.70710678;
+            diry*=0.70710678;
+        }
+        const float lasty=pl[p].p.y;
+        pl[p].v.x=WALK_SPEED*(diry*cosf(lookr)-dirx*sinf(lookr));
+        pl[p].v.z=WALK_SPEED*(dirx*cosf(lookr)+diry*sinf(lookr));
+        pl[p].p.adds(pl[p].v,t);
+        if(pl[p].p.y>0){
+            pl[p].v.y-=GRAVITY*t;
+        }else{
+            pl[p].p.y=0;
+            pl[p].v.y=0;
+            pl[p].onground=true;
+        }
+        if(collideCharacter(p,true,pl[p].p.x,pl[p].p.y,pl[p].p.z,PL_RAD)==2){
+            if(pl[p].v.y<CLIMB_SPEED)
+                pl[p].v.y=CLIMB_SPEED;
+            pl[p].onground=true;
+        }
+        if(in.keys&KB_JUMP && pl[p].onground){
+            pl[p].v.y=JUMP_SPEED;
+            pl[p].p.y+=0.01f;
+            pl[p].onground=false;
+        }
+        if(pl[p].p.y<lasty)
+            pl[p].onground=false;
+    }
+
+    //random numbers per zed so draws don't depend on the order zeds are updated in
+    inline float zedRand(const int i){
+        zed.rnd[i]=zed.rnd[i]*1664525u+1013904223u;
+        return (float)(zed.rnd[i]>>8)*(1.0f/16777216.0f);
+    }
+
+    //shared flow field towards the nearest player. a breadth first search
+    //from every player's cell that only crosses open edges and doorways, redone
+    //when a player changes cells. chasers look up where to head from their cell
+    const int FLOW_GIVEUP=4; //cells past ZED_RANGE before a chase is dropped
+    unsigned char flowdist[32*32]; //cells from the nearest player, 255 if unreachable
+    unsigned char flowpl[32*32]; //which player that is
+    float flowx[32*32],flowz[32*32]; //point to walk to, the next cell's middle or doorway
+    int flowsrc[MAX_PLAYERS]; //player cells the field was built from, -1 for none
+    int flowbuilds=0;
+
+    void buildFlow(){
+        int queue[32*32];
+        int head=0,tail=0;
+        for(int c=0;c<32*32;c++)
+            flowdist[c]=255;
+        for(int p=0;p<MAX_PLAYERS;p++){
+            const int c=flowsrc[p];
+            if(c!=-1 && flowdist[c]!=0){
+                flowdist[c]=0;
+                flowpl[c]=p;
+                queue[tail++]=c;
+            }
+        }
+        const int steps[4]={-1,1,-32,32};
+        while(head<tail){
+            const int c=queue[head++];
+            for(int k=0;k<4;k++){
+                const int n=c+steps[k];
+                const int nx=n%32,nz=n/32;
+                if(nx<1 || nx>30 || nz<1 || nz>30 || flowdist[n]!=255 || wallBetween(c,n))
+                    continue;
+                flowdist[n]=flowdist[c]+1;
+                flowpl[n]=flowpl[c];
+                const int lo=c<n?c:n;
+                if((map[c]|map[n])&INSIDE_BIT){ //through the doorway
+                    const bool xedge=k<2;
+                    flowx[n]=xedge?(lo%32+1)*16.0f:lo%32*16.0f+6.0f;
+                    flowz[n]=xedge?lo/32*16.0f+6.0f:(lo/32+1)*16.0f;
+                }else{
+                    flowx[n]=c%32*16.0f+8.0f;
+                    flowz[n]=c/32*16.0f+8.0f;
+                }
+                queue[tail++]=n;
+            }
+        }
+        flowbuilds++;
+    }
+
+    //simulation level of detail. band k is zeds within lodcells[k] cells of
+    //the nearest player but not lodcells[k-1], they update every 2^k steps
+    //with that much more time. past the last band they sleep. distance is
+    //counted in whole cells so zeds wake as soon as a player enters a cell
+    //close enough
+    int lodcells[LOD_BANDS]={2,4,8,12};
+    unsigned char lodband[32*32]; //band of each cell, LOD_BANDS for asleep
+    int lodcounts[LOD_BANDS+1]; //zeds in each band last step
+    int lodupdates=0,lodfull=0; //zed updates run, and what full rate would have run
+
+    void buildLod(){
+        unsigned char dist[32*32];
+        int queue[32*32];
+        int head=0,tail=0;
+        for(int c=0;c<32*32;c++)
+            dist[c]=255;
+        for(int p=0;p<MAX_PLAYERS;p++){
+            const int c=flowsrc[p];
+            if(c!=-1 && dist[c]!=0){
+                dist[c]=0;
+                queue[tail++]=c;
+            }
+        }
+        //8 way so distance is the larger of the x and z cell counts
+        while(head<tail){
+            const int c=queue[head++];
+            for(int dz=-1;dz<=1;dz++)
+            for(int dx=-1;dx<=1;dx++){
+                const int nx=c%32+dx,nz=c/32+dz;
+                if(nx<0 || nx>31 || nz<0 || nz>31 || dist[nz*32+nx]!=255)
+                    continue;
+                dist[nz*32+nx]=dist[c]+1;
+                queue[tail++]=nz*32+nx;
+            }
+        }
+        for(int c=0;c<32*32;c++){
+            int b=0;
+            while(b<LOD_BANDS && dist[c]>lodcells[b])
+                b++;
+            lodband[c]=b;
+        }
+    }
+
+    void setLodBands(const int *cells){
+        //the first band has to cover anything a zed could spot
+        int last=(int)(ZED_RANGE/16.0f);
+        for(int b=0;b<LOD_BANDS;b++)
+            last=lodcells[b]=max(cells[b],last);
+        flowstale=true;
+    }
+
+    void getLodStats(int *counts, int *updates, int *full){
+        for(int b=0;b<=LOD_BANDS;b++)
+            counts[b]=lodcounts[b];
+        *updates=lodupdates;
+        *full=lodfull;
+    }
+
+    void updateFlow(){
+        bool changed=flowstale;
+        flowstale=false;
+        for(int p=0;p<MAX_PLAYERS;p++){
+            const int c=pl[p].state?(int)(pl[p].p.z/16.0f)*32+(int)(pl[p].p.x/16.0f):-1;
+            if(c!=flowsrc[p]){
+                flowsrc[p]=c;
+                changed=true;
+            }
+        }
+        if(changed){
+            buildFlow();
+            buildLod();
+        }
+    }
+
+    int getFlowBuilds(){
+        return flowbuilds;
+    }
+
+    //pace for every zed this step from its band, staggered by id so each
+    //band's updates spread evenly over its period
+    void scheduleZeds(){
+        updateFlow();
+        for(int b=0;b<=LOD_BANDS;b++)
+            lodcounts[b]=0;
+        for(int i=0;i<zed.top;i++)
+            zed.pace[i]=0.0f;
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(zed.walk[i]<=0)
+                continue;
+            const int b=lodband[(int)(zed.pz[i]/16.0f)*32+(int)(zed.px[i]/16.0f)];
+            lodcounts[b]++;
+            lodfull++;
+            if(b==LOD_BANDS)
+                continue;
+            const unsigned int period=1u<<b;
+            if(((tick+i)&(period-1))==0){
+                zed.pace[i]=(float)period;
+                lodupdates++;
+            }
+        }
+    }
+
+    //point an attacking zed along the field, or give up if the players it
+    //could reach are too far
+    void chaseZed(const int i){
+        const int c=(int)(zed.pz[i]/16.0f)*32+(int)(zed.px[i]/16.0f);
+        if(flowdist[c]>ZED_RANGE/16.0f+FLOW_GIVEUP){
+            zed.state[i]=Z_WANDERING;
+            turnZed(i,zedRand(i)*M_PI*2);
+        }else if(flowdist[c]==0){
+            const Player& p=pl[flowpl[c]];
+            turnZed(i,atan2f(p.p.z-zed.pz[i],p.p.x-zed.px[i]));
+        }else
+            turnZed(i,atan2f(flowz[c]-zed.pz[i],flowx[c]-zed.px[i]));
+    }
+
+    //a paced zed walks several ticks at once, further than the push out of
+    //the walls can catch, so the walk is taken back and done again in pieces
+    //checked against the walls. the last piece is left to collideCharacter
+    const float MAX_STRIDE=PL_RAD*0.75f;
+    float zedstep; //distance a walking zed covers in one tick
+
+    void strideZed(const int i){
+        const float dist=zed.pace[i]*zedstep;
+        if(dist<=MAX_STRIDE)
+            return;
+        const int n=(int)ceilf(dist/MAX_STRIDE);
+        const float s=dist/n;
+        float x=zed.px[i]-zed.dirx[i]*dist;
+        float z=zed.pz[i]-zed.dirz[i]*dist;
+        for(int k=1;k<n;k++){
+            x+=zed.dirx[i]*s;
+            z+=zed.dirz[i]*s;
+            if(x<16.0f || z<16.0f || x>=31.0f*16.0f || z>=31.0f*16.0f)
+                return; //off the edge, collideCharacter puts it back
+            const int ix=x/16.0f;
+            const int iz=z/16.0f;
+            collideWalls(iz*32+ix,x-ix*16.0f,z-iz*16.0f,x,z,PL_RAD);
+        }
+        zed.px[i]=x+zed.dirx[i]*s;
+        zed.pz[i]=z+zed.dirz[i]*s;
+    }
+
+    //ai and collision for one zed on its feet. it only writes itself and the
+    //cells next to its own, and reads zeds up to two cells away. player hits
+    //are queued since players are shared between tiles
+    void thinkZed(const int i, std::vector<int>& hits){
+        strideZed(i);
+        switch(zed.state[i]){
+            case Z_WANDERING: {
+                //wander aimlessly
+                switch(collideCharacter(i,false,zed.px[i],zed.py[i],zed.pz[i],PL_RAD)){
+                case 0:
+                    for(int p=0;p<numplayers;p++) if(pl[p].state)
+                        if(sqr(pl[p].p.x-zed.px[i])+sqr(pl[p].p.z-zed.pz[i])<2.56f){
+                            const float dist=sqrtf(sqr(zed.px[i]-pl[p].p.x)+sqr(zed.pz[i]-pl[p].p.z));
+                            zed.px[i]+=(1.60f-dist)*(zed.px[i]-pl[p].p.x)/dist;
+                            zed.pz[i]+=(1.60f-dist)*(zed.pz[i]-pl[p].p.z)/dist;
+                            turnZed(i,zedRand(i)*M_PI*2);
+                        }
+                    break;
+                case 2:
+                    if(zed.vy[i]<CLIMB_SPEED)
+                        zed.vy[i]=CLIMB_SPEED;
+                    break;
+                default:
+                    turnZed(i,zedRand(i)*M_PI*2);
+                    for(int p=0;p<numplayers;p++) if(pl[p].state)
+                        if(sqr(pl[p].p.x-zed.px[i])+sqr(pl[p].p.z-zed.pz[i])<ZED_RANGE*ZED_RANGE){
+                            zed.state[i]=Z_ATTACKING;
+                            turnZed(i,atan2f(pl[p].p.z-zed.pz[i],pl[p].p.x-zed.px[i]));
+                        }
+                }
+                } break;
+            case Z_ATTACKING: {
+                for(int p=0;p<numplayers;p++) if(pl[p].state)
+                    if(sqr(pl[p].p.x-zed.px[i])+sqr(pl[p].p.z-zed.pz[i])<2.56f){
+                        hits.push_back(p);
+                        zed.state[i]=Z_WANDERING;
+                        turnZed(i,zedRand(i)*M_PI*2);
+                    }
+                if(zed.state[i]==Z_ATTACKING)
+                    chaseZed(i);
+                //walls and other zeds just push, the field steers around them
+                if(collideCharacter(i,false,zed.px[i],zed.py[i],zed.pz[i],PL_RAD)==2)
+                    if(zed.vy[i]<CLIMB_SPEED)
+                        zed.vy[i]=CLIMB_SPEED;
+                } break;
+            default:
+                break;
+        }
+    }
+
+    //walking zeds are updated in square tiles of cells. tiles are coloured like
+    //a 2x2 checkerboard so same coloured tiles are TILE cells apart, nothing
+    //one of them touches is read by another and a whole colour can run at once.
+    //zeds are bucketed by tile in active list order, which makes the result
+    //the same for any thread count
+    const int TILE=4;
+    const int TILES=32/TILE;
+    int tilestart[TILES*TILES+1];
+    int tilezeds[MAX_ZEDS];
+    std::vector<int> tilehits[TILES*TILES]; //zed, player pairs in update order
+
+    std::vector<int> workerhits[MAX_WORKERS]; //scratch for thinkZed, kept between ticks
+    const int PARALLEL_ZEDS=512; //zed updates in a tick worth spreading over the workers
+
+    void thinkTile(int task, int worker, void *arg){
+        const int color=*(int*)arg;
+        const int tx=task%(TILES/2)*2+(color&1);
+        const int tz=task/(TILES/2)*2+(color>>1);
+        const int tile=tz*TILES+tx;
+        std::vector<int> &hits=workerhits[worker];
+        tilehits[tile].clear();
+        for(int k=tilestart[tile];k<tilestart[tile+1];k++){
+            const int i=tilezeds[k];
+            hits.clear();
+            thinkZed(i,hits);
+            for(unsigned int h=0;h<hits.size();h++){
+                tilehits[tile].push_back(i);
+                tilehits[tile].push_back(hits[h]);
+            }
+        }
+    }
+
+    void thinkZeds(){
+        int fill[TILES*TILES];
+        for(int k=0;k<=TILES*TILES;k++)
+            tilestart[k]=0;
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(zed.pace[i]>0)
+                tilestart[zed.iz[i]/TILE*TILES+zed.ix[i]/TILE+1]++;
+        }
+        for(int k=0;k<TILES*TILES;k++){
+            tilestart[k+1]+=tilestart[k];
+            fill[k]=tilestart[k];
+        }
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(zed.pace[i]>0)
+                tilezeds[fill[zed.iz[i]/TILE*TILES+zed.ix[i]/TILE]++]=i;
+        }
+
+        //a light tick finishes before the workers would have woken
+        for(int color=0;color<4;color++)
+            if(tilestart[TILES*TILES]<PARALLEL_ZEDS)
+                for(int task=0;task<TILES*TILES/4;task++)
+                    thinkTile(task,0,&color);
+            else
+                runTasks(TILES*TILES/4,thinkTile,&color);
+
+        //zed hits on players, in tile order
+        for(int k=0;k<TILES*TILES;k++)
+            for(unsigned int h=0;h<tilehits[k].size();h+=2){
+                const int p=tilehits[k][h+1];
+                pl[p].health-=ZED_DAMAGE;
+                if(pl[p].health<0)
+                    respawnPlayer(0);
+            }
+    }
+
+    const int BULLET_TASK=64; //bullets per tracing task
+    float bulletstep;
+    int bullethits[MAX_BULLETS]; //collideLine result for each live bullet
+    int hitzeds[MAX_BULLETS]; //zeds shot so far this tick
+    const float HIT_REACH=4.0f; //past the segment a zed's boxes can reach, standing or down
+    unsigned int bullettargets[MAX_BULLETS]; //handle of the zed hit, if any
+
+    //only reads the world, so any number of these can run at once
+    void traceBullets(int task, int worker, void *arg){
+        const int end=min((task+1)*BULLET_TASK,bulletslots.count);
+        for(int k=task*BULLET_TASK;k<end;k++){
+            const int i=bulletslots.order[k];
+            const int c=collideLine(bullets[i].p.x,bullets[i].p.y,bullets[i].p.z,
+                bullets[i].v.x*bulletstep,bullets[i].v.y*bulletstep,bullets[i].v.z*bulletstep);
+            bullethits[i]=c;
+            if(c>=0)
+                bullettargets[i]=zedslots.handle(c);
+        }
+    }
+
+    int step(const float t){
+        if(t<=0)
+            return 0;
+        tick++;
+        if(sortedgrid)
+            sortGrid();
+
+        //player loops stop at the highest slot in use
+        numplayers=MAX_PLAYERS;
+        while(numplayers>0 && !pl[numplayers-1].state)
+            numplayers--;
+
+        for(int p=0;p<numplayers;p++) if(pl[p].state){
+            const vect aim(cosf(pl[p].lookr)*cosf(pl[p].lookp),
+                            sinf(pl[p].lookp),
+                            sinf(pl[p].lookr)*cosf(pl[p].lookp));
+
+            //pickup
+            if(isserver && pl[p].keys&KB_USE && (pl[p].health<100 || pl[p].ammo<120)){
+                const int i=findPickup(pl[p].p.x,pl[p].p.z,pl[p].health<100,pl[p].ammo<120);
+                if(i!=-1){
+                    if(zed.state[i]==Z_HEALTH){
+                        pl[p].health+=25;
+                        if(pl[p].health>100)
+                            pl[p].health=100;
+                    }else{
+                        pl[p].ammo+=30;
+                        if(pl[p].ammo>120)
+                            pl[p].ammo=120;
+                    }
+                    setZedState(i,Z_NONE);
+                }
+            }
+
+            //shooting
+            if(pl[p].shootdelay>0)
+                pl[p].shootdelay-=t;
+            if(pl[p].ammo>0 && pl[p].keys&KB_FIRE && pl[p].shootdelay<=0){
+                const int i=bulletslots.alloc();
+                if(i!=-1){
+                    bullets[i].p.set(pl[p].p).adds(aim,0.75f);
+                    bullets[i].p.y+=2.5f-0.3f;
+                    bullets[i].v.set(pl[p].v).adds(aim,BULLET_SPEED);
+                    bullets[i].v.y+=0.15f*GRAVITY;
+                    pl[p].ammo--;
+                }
+                pl[p].shootdelay=SHOOT_DELAY;
+            }
+        }
+
+        //bullets, traced all at once against the zeds as they were at the
+        //start of the tick then applied one by one
+        bulletstep=t;
+        int nhit=0;
+        runTasks((bulletslots.count+BULLET_TASK-1)/BULLET_TASK,traceBullets,NULL);
+        for(int k=bulletslots.count-1;k>=0;k--){
+            const int i=bulletslots.order[k];
+            const float dx=bullets[i].v.x*t;
+            const float dy=bullets[i].v.y*t;
+            const float dz=bullets[i].v.z*t;
+            int c=bullethits[i]>=0?findZed(bullettargets[i]):bullethits[i];
+            //a bullet passing near a zed already hit this tick is traced
+            //again against the zeds as they are now, as if the bullets had
+            //flown one after another
+            const float reach=sqr(sqrtf(dx*dx+dy*dy+dz*dz)+HIT_REACH);
+            for(int h=0;h<nhit;h++)
+                if(sqr(zed.px[hitzeds[h]]-bullets[i].p.x)+sqr(zed.pz[hitzeds[h]]-bullets[i].p.z)<reach){
+                    c=collideLine(bullets[i].p.x,bullets[i].p.y,bullets[i].p.z,dx,dy,dz);
+                    break;
+                }
+            if(c!=-1){
+                if(c>=0 && isserver){
+                    hitzeds[nhit++]=c;
+                    hitZed(c);
+                }
+                Particle &hit=newParticle();
+                hit.p.set(bullets[i].p);
+                hit.age=PARTICLE_AGE*4.0f;
+                bullets[i].p.x=-1;
+                bulletslots.release(i);
+                continue;
+            }
+            bullets[i].v.y-=GRAVITY*t;
+            float dist=sqrtf(dx*dx+dy*dy+dz*dz);
+            for(;;){
+                Particle &trail=newParticle();
+                trail.p.set(bullets[i].p).add(dx*dist,dy*dist,dz*dist);
+                trail.age=PARTICLE_AGE;
+                if((dist-=PARTICLE_INTERVAL)<=0)
+                    break;
+            }
+            bullets[i].p.add(dx,dy,dz);
+        }
+
+        //particles, the run of live ones ages and the ones at the old end
+        //that ran out drop off
+        for(int k=0;k<particlecount;k++)
+            particles[(particlefirst+k)&PARTICLE_MASK].age-=t;
+        while(particlecount>0 && particles[particlefirst].age<0){
+            particlefirst=(particlefirst+1)&PARTICLE_MASK;
+            particlecount--;
+        }
+
+        //zeds, everyone on their feet walks along their heading first. on the
+        //client that is all there is between updates from the server
+        if(isserver)
+            scheduleZeds();
+        zedstep=ZED_SPEED*t;
+        moveZeds(zed.px,zed.pz,zed.dirx,zed.dirz,isserver?zed.pace:zed.walk,zed.top,zedstep);
+        if(isserver){
+            thinkZeds();
+            fallZeds(zed.py,zed.vy,zed.pace,zed.top,t,GRAVITY);
+        }
+        for(int a=0;a<zed.count;a++){
+            const int i=zed.active[a];
+            if(zed.state[i]==Z_HEALTH || zed.state[i]==Z_AMMO)
+                zed.rot[i]+=t*3.0f;
+            else if(!isserver && zed.walk[i]>0
+                && zed.px[i]>=16.0f && zed.px[i]<31.0f*16.0f
+                && zed.pz[i]>=16.0f && zed.pz[i]<31.0f*16.0f)
+                updateColInfo(i);
+        }
+
+        return 0;
+    }
+
+}
+
@@ -0,0 +1,197 @@
+#ifndef H_SIM
+#define H_SIM
+
+#include <math.h>
+
+//simulation core, no SDL/GL dependency
+//driven by explicit timesteps so runs are reproducible for a given seed
+
+namespace Game{
+
+    struct vect{
+        float x,y,z;
+        inline vect():x(0.0f),y(0.0f),z(0.0f){}
+        inline vect(const float _x, const float _y, const float _z):x(_x),y(_y),z(_z){}
+        inline vect& set(const vect& v){ x=v.x; y=v.y; z=v.z; return *this; }
+        inline vect& set(const float _x,const float _y,const float _z){x=_x;y=_y;z=_z;return *this;}
+        inline vect& add(const vect& v){ x+=v.x; y+=v.y; z+=v.z; return *this; }
+        inline vect& sub(const vect& v){ x-=v.x; y-=v.y; z-=v.z; return *this; }
+        inline vect& add(const float _x,const float _y,const float _z){x+=_x;y+=_y;z+=_z;return *this;}
+        inline vect& adds(const vect& v, const float s){ x+=v.x*s; y+=v.y*s; z+=v.z*s; return *this; }
+        inline vect& cross(const vect& v){
+            const float ox=x,oy=y; x=oy*v.z-z*v.y; y=z*v.x-ox*v.z; z=ox*v.y-oy*v.x; return *this; }
+        inline vect& normalize(){
+            float d=x*x+y*y+z*z; if(d>0){ d=1.0f/sqrtf(d); x*=d; y*=d; z*=d; } return *this; }
+    };
+    inline float dot(const vect& v, const vect& w){ return v.x*w.x+v.y*w.y+v.z*w.z; }
+    inline float len(const vect& v){ return sqrtf(v.x*v.x+v.y*v.y+v.z*v.z); }
+
+    struct OBB{
+        vect ax,ay,az; //orthonormal basis
+        vect p,e; //center position, extents
+        inline OBB():ax(1.0f,0.0f,0.0f),ay(0.0f,1.0f,0.0f),az(0.0f,0.0f,1.0f){}
+        inline OBB(const vect& _p, const vect& _e)
+            :ax(1.0f,0.0f,0.0f),ay(0.0f,1.0f,0.0f),az(0.0f,0.0f,1.0f),p(_p),e(_e){}
+        void rotatex(const float r){
+            const float co=cosf(r); const float si=sinf(r); vect by,bz;
+            by.adds(ay,co).adds(az,si); bz.adds(ay,-si).adds(az,co); ay.set(by); az.set(bz); }
+        void rotatey(const float r){
+            const float co=cosf(r); const float si=sinf(r); vect bx,bz;
+            bx.adds(az,-si).adds(ax,co); bz.adds(az,co).adds(ax,si); ax.set(bx); az.set(bz); }
+        void rotatez(const float r){
+            const float co=cosf(r); const float si=sinf(r); vect bx,by;
+            bx.adds(ax,co).adds(ay,si); by.adds(ax,-si).adds(ay,co); ax.set(bx); ay.set(by); }
+        void translate(const vect& v){ p.adds(ax,v.x).adds(ay,v.y).adds(az,v.z); }
+        void ltow(vect& v)const{ vect r; r.adds(ax,v.x).adds(ay,v.y).adds(az,v.z).add(p); v.set(r); }
+        void wtol(vect& v)const{ v.sub(p); v.set(dot(ax,v),dot(ay,v),dot(az,v)); }
+    };
+
+    const char INSIDE_BIT=0x01;
+    const char DOORX_BIT=0x02;
+    const char DOORZ_BIT=0x04;
+
+    const int MAX_PLAYERS=256; //ids go over the wire as a byte
+    const int MAX_ZEDS=4096;
+    const int MAX_BULLETS=1024;
+    const int MAX_PARTICLES=16384; //a power of two, the ring wraps with a mask
+    const int PARTICLE_MASK=MAX_PARTICLES-1;
+    const int LOD_BANDS=4; //zed update rate bands, full, 1/2, 1/4 and 1/8
+    const unsigned char Z_NONE=0;
+    const unsigned char Z_DEAD=1;
+    const unsigned char Z_WANDERING=3; //wandering about
+    const unsigned char Z_ATTACKING=4; //running at players
+    const unsigned char Z_HEALTH=10; //pickup
+    const unsigned char Z_AMMO=11; //pickup
+
+    struct Player{
+        vect p;
+        vect v;
+        float lookr,lookp;
+        float shootdelay;
+        int health,ammo;
+        bool onground;
+        unsigned char keys;
+        unsigned char state;
+    };
+
+    //zeds and pickups as parallel arrays indexed by id, ids are stable since
+    //they go over the wire. live ids are also kept densely in active so hot
+    //loops skip empty slots
+    struct Zeds{
+        float px[MAX_ZEDS],py[MAX_ZEDS],pz[MAX_ZEDS];
+        float vx[MAX_ZEDS],vy[MAX_ZEDS],vz[MAX_ZEDS];
+        float rot[MAX_ZEDS];
+        float dirx[MAX_ZEDS],dirz[MAX_ZEDS]; //heading, kept in step with rot by turnZed
+        float walk[MAX_ZEDS]; //1 if the zed walks along its heading, 0 otherwise
+        float pace[MAX_ZEDS]; //server only, steps walk covers this step, 0 to sit it out
+        //collision box, rotated about y only so its x axis is (obbc,0,-obbs) and
+        //z axis (obbs,0,obbc). center is the position raised by obbey.
+        //refreshed on turns and state changes
+        float obbc[MAX_ZEDS],obbs[MAX_ZEDS];
+        float obbex[MAX_ZEDS],obbey[MAX_ZEDS],obbez[MAX_ZEDS];
+        int ix[MAX_ZEDS],iz[MAX_ZEDS]; //cell
+        int cnext[MAX_ZEDS],cprev[MAX_ZEDS]; //cell list links
+        unsigned char state[MAX_ZEDS];
+        unsigned int rnd[MAX_ZEDS]; //own random state, seeded when the zed appears
+        int active[MAX_ZEDS]; //unordered
+        int slot[MAX_ZEDS]; //index into active, -1 if Z_NONE
+        int count;
+        int top; //one past the highest live id, bounds the batched kernels
+    };
+
+    struct Bullet{
+        vect p;
+        vect v;
+    };
+
+    struct Particle{
+        vect p;
+        float age;
+    };
+
+    enum {
+        KB_LEFT=1,
+        KB_RIGHT=2,
+        KB_FORWARD=4,
+        KB_BACK=8,
+        KB_JUMP=16,
+        KB_USE=32,
+        KB_FIRE=64
+    };
+
+    const float TIMESTEP=1.0f/60.0f; //fixed simulation tick
+    const float ZED_SPEED=15.0f; //walking, in units a second
+    const int MAX_PACE=1<<(LOD_BANDS-1); //ticks the slowest band walks in one update
+    const float PL_SPEED=20.0f; //walking while falling off a wall, in units a second
+
+    //one client input, movement is applied per input rather than per tick
+    struct Input{
+        unsigned int seq;
+        unsigned char keys;
+        unsigned short aimr,aimp;
+        unsigned char msec;
+    };
+
+    extern int plid; //local player id, -1 on server
+    extern char *map;
+    extern int *cols;
+    extern Player pl[MAX_PLAYERS];
+    extern Zeds zed;
+    extern Bullet bullets[MAX_BULLETS];
+    //particles are a ring in the order they were made, the live ones are
+    //particles[(particlefirst+k)&PARTICLE_MASK] for k below particlecount.
+    //a short lived one can run out (age<0) before an older one and stay in
+    //the run until that goes
+    extern Particle particles[MAX_PARTICLES];
+    extern int particlefirst;
+    extern int particlecount;
+
+    void seed(unsigned long s);
+    void resetWorld();
+    int initServer();
+    //buildings and doors only depend on the seed, clients rebuild them from it
+    void generateMap(unsigned long s);
+    unsigned long getMapSeed();
+    int step(float t);
+    //threads for the zed update, results are the same for any count
+    int setThreads(int n);
+    //broadphase, per cell zed lists kept up to date as zeds move (default)
+    //or all zeds sorted by cell at the start of every step
+    void setSortedGrid(bool on);
+    bool getSortedGrid();
+    void movePlayer(int p, const Input& in);
+    unsigned int getTick();
+    void respawnPlayer(int p);
+    int spawnZed(float x, float z, float rot);
+    //ids with a generation, findZed gives -1 once the zed is gone
+    unsigned int getZedHandle(int i);
+    int findZed(unsigned int h);
+    void removePlayer(int p);
+
+    void setKeys(int i, unsigned char keys);
+    void setAim(int i, unsigned short aimr, unsigned short aimp);
+    unsigned short getAimr(int i);
+    unsigned short getAimp(int i);
+    unsigned char* getMap();
+    void getMapSize(int *w, int *h);
+    unsigned int hashMap();
+    bool lineOfSight(float x0, float z0, float x1, float z1);
+    //distances in cells where zeds drop to the next lower update rate,
+    //past the last one they sleep
+    void setLodBands(const int *cells);
+    //zeds in each band and asleep last step, zed updates run and the
+    //updates full rate would have run since start
+    void getLodStats(int *counts, int *updates, int *full);
+    //times the zed flow field was rebuilt since start
+    int getFlowBuilds();
+    //pickup lookups and pickups looked at since start
+    void getPickupStats(int *queries, int *scanned);
+    bool intersectionOBB(const OBB& a, const OBB& b);
+    int getPlayerUpdate(int i, unsigned short *pv, unsigned char* kha);
+    int setPlayerUpdate(int i, const unsigned short *pv, const unsigned char* kha);
+    int getZedUpdate(int i, unsigned short *v, unsigned char *state);
+    int setZedUpdate(int i, const unsigned short *v, unsigned char state);
+
+}
+
+#endif
@@ -0,0 +1,357 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace Game{
+
+    void moveZedsScalar(float *px, float *pz, const float *dirx, const float *dirz,
+        const float *walk, int n, float s){
+        for(int i=0;i<n;i++){
+            const float k=walk[i]*s;
+            px[i]+=dirx[i]*k;
+            pz[i]+=dirz[i]*k;
+        }
+    }
+
+    void fallZedsScalar(float *py, float *vy, const float *walk, int n, float t, float g){
+        const float gt=g*t;
+        for(int i=0;i<n;i++) if(walk[i]>0){
+            if(py[i]>=0){
+                py[i]+=vy[i]*(t*walk[i]);
+                vy[i]-=gt*walk[i];
+            }else{
+                py[i]=0;
+                vy[i]=0;
+            }
+        }
+    }
+
+    inline void boxOBB(OBB& o, const Boxes& b, const int j){
+        o.p.set(b.px[j],b.py[j],b.pz[j]);
+        o.e.set(b.ex[j],b.ey[j],b.ez[j]);
+        o.ax.set(b.c[j],0.0f,-b.s[j]);
+        o.ay.set(0.0f,1.0f,0.0f);
+        o.az.set(b.s[j],0.0f,b.c[j]);
+    }
+
+    //separating axis test between the segment and box j
+    bool segmentVsBox(const float *p1, const float *p2, const Boxes& bx, const int j){
+        OBB b;
+        boxOBB(b,bx,j);
+        vect a(p1[0],p1[1],p1[2]);
+        vect d(p2[0],p2[1],p2[2]);
+        b.wtol(a);
+        b.wtol(d);
+        vect l(d); l.sub(a); l.normalize();
+        vect t(d);
+        d.sub(a);
+        return !(fabs(t.x) > b.e.x+fabs(d.x)
+        ||   fabs(t.y) > b.e.y+fabs(d.y)
+        ||   fabs(t.z) > b.e.z+fabs(d.z)
+        || fabs(t.y*l.z-t.z*l.y) > b.e.y*fabs(l.z)+b.e.z*fabs(l.y)
+        || fabs(t.x*l.z-t.z*l.x) > b.e.z*fabs(l.x)+b.e.x*fabs(l.z)
+        || fabs(t.x*l.y-t.y*l.x) > b.e.x*fabs(l.y)+b.e.y*fabs(l.x));
+    }
+
+    int segmentVsBoxesFrom(const float *p1, const float *p2, const Boxes& b, int j){
+        for(;j<b.n;j++)
+            if(segmentVsBox(p1,p2,b,j))
+                return j;
+        return -1;
+    }
+
+    int segmentVsBoxesScalar(const float *p1, const float *p2, const Boxes& b){
+        return segmentVsBoxesFrom(p1,p2,b,0);
+    }
+
+    int obbVsBoxesFrom(const OBB& a, const Boxes& b, int j){
+        for(;j<b.n;j++){
+            OBB o;
+            boxOBB(o,b,j);
+            if(intersectionOBB(a,o))
+                return j;
+        }
+        return -1;
+    }
+
+    int obbVsBoxesScalar(const OBB& a, const Boxes& b){
+        return obbVsBoxesFrom(a,b,0);
+    }
+
+#ifdef SIMD_X86
+    //the batched tests below repeat the scalar arithmetic operation for operation.
+    //box axes have zero y terms and a unit y axis, products with those only
+    //change the sign of zeros so they're left out
+
+    #define ABS(x) _mm_andnot_ps(sign,(x))
+    #define ADD(x,y) _mm_add_ps((x),(y))
+    #define SUB(x,y) _mm_sub_ps((x),(y))
+    #define MUL(x,y) _mm_mul_ps((x),(y))
+    #define GT(x,y) _mm_cmpgt_ps((x),(y))
+
+    __attribute__((target("sse2")))
+    int segmentVsBoxesSSE2(const float *p1, const float *p2, const Boxes& b){
+        const __m128 sign=_mm_set1_ps(-0.0f);
+        const __m128 zero=_mm_setzero_ps();
+        const __m128 one=_mm_set1_ps(1.0f);
+        int j=0;
+        for(;j+4<=b.n;j+=4){
+            const __m128 px=_mm_loadu_ps(&b.px[j]);
+            const __m128 py=_mm_loadu_ps(&b.py[j]);
+            const __m128 pz=_mm_loadu_ps(&b.pz[j]);
+            const __m128 c=_mm_loadu_ps(&b.c[j]);
+            const __m128 s=_mm_loadu_ps(&b.s[j]);
+            const __m128 ex=_mm_loadu_ps(&b.ex[j]);
+            const __m128 ey=_mm_loadu_ps(&b.ey[j]);
+            const __m128 ez=_mm_loadu_ps(&b.ez[j]);
+            //both ends in box space
+            __m128 vx=SUB(_mm_set1_ps(p1[0]),px);
+            __m128 vz=SUB(_mm_set1_ps(p1[2]),pz);
+            const __m128 ax=SUB(MUL(c,vx),MUL(s,vz));
+            const __m128 ay=SUB(_mm_set1_ps(p1[1]),py);
+            const __m128 az=ADD(MUL(s,vx),MUL(c,vz));
+            vx=SUB(_mm_set1_ps(p2[0]),px);
+            vz=SUB(_mm_set1_ps(p2[2]),pz);
+            const __m128 tx=SUB(MUL(c,vx),MUL(s,vz));
+            const __m128 ty=SUB(_mm_set1_ps(p2[1]),py);
+            const __m128 tz=ADD(MUL(s,vx),MUL(c,vz));
+            const __m128 dx=SUB(tx,ax);
+            const __m128 dy=SUB(ty,ay);
+            const __m128 dz=SUB(tz,az);
+            //normalized direction, zero length stays zero
+            const __m128 dd=ADD(ADD(MUL(dx,dx),MUL(dy,dy)),MUL(dz,dz));
+            const __m128 pos=GT(dd,zero);
+            const __m128 inv=_mm_div_ps(one,_mm_sqrt_ps(dd));
+            const __m128 lx=_mm_or_ps(_mm_and_ps(pos,MUL(dx,inv)),_mm_andnot_ps(pos,dx));
+            const __m128 ly=_mm_or_ps(_mm_and_ps(pos,MUL(dy,inv)),_mm_andnot_ps(pos,dy));
+            const __m128 lz=_mm_or_ps(_mm_and_ps(pos,MUL(dz,inv)),_mm_andnot_ps(pos,dz));
+
+            __m128 miss=GT(ABS(tx),ADD(ex,ABS(dx)));
+            miss=_mm_or_ps(miss,GT(ABS(ty),ADD(ey,ABS(dy))));
+            miss=_mm_or_ps(miss,GT(ABS(tz),ADD(ez,ABS(dz))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(ty,lz),MUL(tz,ly))),ADD(MUL(ey,ABS(lz)),MUL(ez,ABS(ly)))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tx,lz),MUL(tz,lx))),ADD(MUL(ez,ABS(lx)),MUL(ex,ABS(lz)))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tx,ly),MUL(ty,lx))),ADD(MUL(ex,ABS(ly)),MUL(ey,ABS(lx)))));
+            const int hit=~_mm_movemask_ps(miss)&15;
+            if(hit)
+                return j+__builtin_ctz(hit);
+        }
+        return segmentVsBoxesFrom(p1,p2,b,j);
+    }
+
+    __attribute__((target("sse2")))
+    int obbVsBoxesSSE2(const OBB& a, const Boxes& b){
+        const __m128 sign=_mm_set1_ps(-0.0f);
+        const __m128 axx=_mm_set1_ps(a.ax.x),axy=_mm_set1_ps(a.ax.y),axz=_mm_set1_ps(a.ax.z);
+        const __m128 ayx=_mm_set1_ps(a.ay.x),ayy=_mm_set1_ps(a.ay.y),ayz=_mm_set1_ps(a.ay.z);
+        const __m128 azx=_mm_set1_ps(a.az.x),azy=_mm_set1_ps(a.az.y),azz=_mm_set1_ps(a.az.z);
+        const __m128 aex=_mm_set1_ps(a.e.x),aey=_mm_set1_ps(a.e.y),aez=_mm_set1_ps(a.e.z);
+        int j=0;
+        for(;j+4<=b.n;j+=4){
+            const __m128 c=_mm_loadu_ps(&b.c[j]);
+            const __m128 s=_mm_loadu_ps(&b.s[j]);
+            const __m128 bex=_mm_loadu_ps(&b.ex[j]);
+            const __m128 bey=_mm_loadu_ps(&b.ey[j]);
+            const __m128 bez=_mm_loadu_ps(&b.ez[j]);
+            //box center in a's space
+            const __m128 vx=SUB(_mm_loadu_ps(&b.px[j]),_mm_set1_ps(a.p.x));
+            const __m128 vy=SUB(_mm_loadu_ps(&b.py[j]),_mm_set1_ps(a.p.y));
+            const __m128 vz=SUB(_mm_loadu_ps(&b.pz[j]),_mm_set1_ps(a.p.z));
+            const __m128 tx=ADD(ADD(MUL(axx,vx),MUL(axy,vy)),MUL(axz,vz));
+            const __m128 ty=ADD(ADD(MUL(ayx,vx),MUL(ayy,vy)),MUL(ayz,vz));
+            const __m128 tz=ADD(ADD(MUL(azx,vx),MUL(azy,vy)),MUL(azz,vz));
+            //rotation matrix
+            const __m128 rxx=SUB(MUL(axx,c),MUL(axz,s)),rxy=axy,rxz=ADD(MUL(axx,s),MUL(axz,c));
+            const __m128 ryx=SUB(MUL(ayx,c),MUL(ayz,s)),ryy=ayy,ryz=ADD(MUL(ayx,s),MUL(ayz,c));
+            const __m128 rzx=SUB(MUL(azx,c),MUL(azz,s)),rzy=azy,rzz=ADD(MUL(azx,s),MUL(azz,c));
+            const __m128 fxx=ABS(rxx),fxy=ABS(rxy),fxz=ABS(rxz);
+            const __m128 fyx=ABS(ryx),fyy=ABS(ryy),fyz=ABS(ryz);
+            const __m128 fzx=ABS(rzx),fzy=ABS(rzy),fzz=ABS(rzz);
+            //a's basis vectors
+            __m128 miss=GT(ABS(tx),ADD(ADD(ADD(aex,MUL(bex,fxx)),MUL(bey,fxy)),MUL(bez,fxz)));
+            miss=_mm_or_ps(miss,GT(ABS(ty),ADD(ADD(ADD(aey,MUL(bex,fyx)),MUL(bey,fyy)),MUL(bez,fyz))));
+            miss=_mm_or_ps(miss,GT(ABS(tz),ADD(ADD(ADD(aez,MUL(bex,fzx)),MUL(bey,fzy)),MUL(bez,fzz))));
+            //most boxes are far enough apart to be done here
+            if(_mm_movemask_ps(miss)==15)
+                continue;
+            //b's basis vectors
+            miss=_mm_or_ps(miss,GT(ABS(ADD(ADD(MUL(tx,rxx),MUL(ty,ryx)),MUL(tz,rzx))),
+                ADD(ADD(ADD(bex,MUL(aex,fxx)),MUL(aey,fyx)),MUL(aez,fzx))));
+            miss=_mm_or_ps(miss,GT(ABS(ADD(ADD(MUL(tx,rxy),MUL(ty,ryy)),MUL(tz,rzy))),
+                ADD(ADD(ADD(bey,MUL(aex,fxy)),MUL(aey,fyy)),MUL(aez,fzy))));
+            miss=_mm_or_ps(miss,GT(ABS(ADD(ADD(MUL(tx,rxz),MUL(ty,ryz)),MUL(tz,rzz))),
+                ADD(ADD(ADD(bez,MUL(aex,fxz)),MUL(aey,fyz)),MUL(aez,fzz))));
+            //9 cross products
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tz,ryx),MUL(ty,rzx))),
+                ADD(ADD(ADD(MUL(aey,fzx),MUL(aez,fyx)),MUL(bey,fxz)),MUL(bez,fxy))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tz,ryy),MUL(ty,rzy))),
+                ADD(ADD(ADD(MUL(aey,fzy),MUL(aez,fyy)),MUL(bex,fxz)),MUL(bez,fxx))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tz,ryz),MUL(ty,rzz))),
+                ADD(ADD(ADD(MUL(aey,fzz),MUL(aez,fyz)),MUL(bex,fxy)),MUL(bey,fxx))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tx,rzx),MUL(tz,rxx))),
+                ADD(ADD(ADD(MUL(aex,fzx),MUL(aez,fxx)),MUL(bey,fyz)),MUL(bez,fyy))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tx,rzy),MUL(tz,rxy))),
+                ADD(ADD(ADD(MUL(aex,fzy),MUL(aez,fxy)),MUL(bex,fyz)),MUL(bez,fyx))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(tx,rzz),MUL(tz,rxz))),
+                ADD(ADD(ADD(MUL(aex,fzz),MUL(aez,fxz)),MUL(bex,fyy)),MUL(bey,fyx))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(ty,rxx),MUL(tx,ryx))),
+                ADD(ADD(ADD(MUL(aex,fyx),MUL(aey,fxx)),MUL(bey,fzz)),MUL(bez,fzy))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(ty,rxy),MUL(tx,ryy))),
+                ADD(ADD(ADD(MUL(aex,fyy),MUL(aey,fxy)),MUL(bex,fzz)),MUL(bez,fzx))));
+            miss=_mm_or_ps(miss,GT(ABS(SUB(MUL(ty,rxz),MUL(tx,ryz))),
+                ADD(ADD(ADD(MUL(aex,fyz),MUL(aey,fxz)),MUL(bex,fzy)),MUL(bey,fzx))));
+            const int hit=~_mm_movemask_ps(miss)&15;
+            if(hit)
+                return j+__builtin_ctz(hit);
+        }
+        return obbVsBoxesFrom(a,b,j);
+    }
+
+    #undef ABS
+    #undef ADD
+    #undef SUB
+    #undef MUL
+    #undef GT
+
+    __attribute__((target("sse2")))
+    void moveZedsSSE2(float *px, float *pz, const float *dirx, const float *dirz,
+        const float *walk, int n, float s){
+        const __m128 ss=_mm_set1_ps(s);
+        int i=0;
+        for(;i+4<=n;i+=4){
+            const __m128 k=_mm_mul_ps(_mm_loadu_ps(&walk[i]),ss);
+            _mm_storeu_ps(&px[i],_mm_add_ps(_mm_loadu_ps(&px[i]),_mm_mul_ps(_mm_loadu_ps(&dirx[i]),k)));
+            _mm_storeu_ps(&pz[i],_mm_add_ps(_mm_loadu_ps(&pz[i]),_mm_mul_ps(_mm_loadu_ps(&dirz[i]),k)));
+        }
+        moveZedsScalar(px+i,pz+i,dirx+i,dirz+i,walk+i,n-i,s);
+    }
+
+    __attribute__((target("sse2")))
+    void fallZedsSSE2(float *py, float *vy, const float *walk, int n, float t, float g){
+        const __m128 zero=_mm_setzero_ps();
+        const __m128 tt=_mm_set1_ps(t);
+        const __m128 gt=_mm_set1_ps(g*t);
+        int i=0;
+        for(;i+4<=n;i+=4){
+            const __m128 y=_mm_loadu_ps(&py[i]);
+            const __m128 v=_mm_loadu_ps(&vy[i]);
+            const __m128 w=_mm_loadu_ps(&walk[i]);
+            //airborne lanes integrate, the rest land, non walkers keep their values
+            const __m128 up=_mm_cmpge_ps(y,zero);
+            const __m128 on=_mm_cmpgt_ps(w,zero);
+            const __m128 ny=_mm_and_ps(up,_mm_add_ps(y,_mm_mul_ps(v,_mm_mul_ps(tt,w))));
+            const __m128 nv=_mm_and_ps(up,_mm_sub_ps(v,_mm_mul_ps(gt,w)));
+            _mm_storeu_ps(&py[i],_mm_or_ps(_mm_and_ps(on,ny),_mm_andnot_ps(on,y)));
+            _mm_storeu_ps(&vy[i],_mm_or_ps(_mm_and_ps(on,nv),_mm_andnot_ps(on,v)));
+        }
+        fallZedsScalar(py+i,vy+i,walk+i,n-i,t,g);
+    }
+
+    __attribute__((target("avx2")))
+    void moveZedsAVX2(float *px, float *pz, const float *dirx, const float *dirz,
+        const float *walk, int n, float s){
+        const __m256 ss=_mm256_set1_ps(s);
+        int i=0;
+        for(;i+8<=n;i+=8){
+            const __m256 k=_mm256_mul_ps(_mm256_loadu_ps(&walk[i]),ss);
+            _mm256_storeu_ps(&px[i],_mm256_add_ps(_mm256_loadu_ps(&px[i]),_mm256_mul_ps(_mm256_loadu_ps(&dirx[i]),k)));
+            _mm256_storeu_ps(&pz[i],_mm256_add_ps(_mm256_loadu_ps(&pz[i]),_mm256_mul_ps(_mm256_loadu_ps(&dirz[i]),k)));
+        }
+        moveZedsScalar(px+i,pz+i,dirx+i,dirz+i,walk+i,n-i,s);
+    }
+
+    __attribute__((target("avx2")))
+    void fallZedsAVX2(float *py, float *vy, const float *walk, int n, float t, float g){
+        const __m256 zero=_mm256_setzero_ps();
+        const __m256 tt=_mm256_set1_ps(t);
+        const __m256 gt=_mm256_set1_ps(g*t);
+        int i=0;
+        for(;i+8<=n;i+=8){
+            const __m256 y=_mm256_loadu_ps(&py[i]);
+            const __m256 v=_mm256_loadu_ps(&vy[i]);
+            const __m256 w=_mm256_loadu_ps(&walk[i]);
+            const __m256 up=_mm256_cmp_ps(y,zero,_CMP_GE_OQ);
+            const __m256 on=_mm256_cmp_ps(w,zero,_CMP_GT_OQ);
+            const __m256 ny=_mm256_and_ps(up,_mm256_add_ps(y,_mm256_mul_ps(v,_mm256_mul_ps(tt,w))));
+            const __m256 nv=_mm256_and_ps(up,_mm256_sub_ps(v,_mm256_mul_ps(gt,w)));
+            _mm256_storeu_ps(&py[i],_mm256_blendv_ps(y,ny,on));
+            _mm256_storeu_ps(&vy[i],_mm256_blendv_ps(v,nv,on));
+        }
+        fallZedsScalar(py+i,vy+i,walk+i,n-i,t,g);
+    }
+#endif
+
+    typedef void (*MoveFn)(float*, float*, const float*, const float*, const float*, int, float);
+    typedef void (*FallFn)(float*, float*, const float*, int, float, float);
+    typedef int (*SegmentFn)(const float*, const float*, const Boxes&);
+    typedef int (*OverlapFn)(const OBB&, const Boxes&);
+
+    MoveFn moveImpl=NULL;
+    FallFn fallImpl=NULL;
+    SegmentFn segmentImpl=NULL;
+    OverlapFn overlapImpl=NULL;
+    const char *simdname="scalar";
+    pthread_once_t picked=PTHREAD_ONCE_INIT; //the first call can come from any worker
+
+    //ZED_SIMD=scalar or sse2 caps the choice, for comparing implementations.
+    //box tests only have sse2 versions, the candidates from a few cells
+    //rarely fill more than a couple of 4 wide batches
+    void pickImpl(){
+        moveImpl=moveZedsScalar;
+        fallImpl=fallZedsScalar;
+        segmentImpl=segmentVsBoxesScalar;
+        overlapImpl=obbVsBoxesScalar;
+#ifdef SIMD_X86
+        const char *cap=getenv("ZED_SIMD");
+        if(cap && !strcmp(cap,"scalar"))
+            return;
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("sse2")){
+            segmentImpl=segmentVsBoxesSSE2;
+            overlapImpl=obbVsBoxesSSE2;
+        }
+        if(__builtin_cpu_supports("avx2") && !(cap && !strcmp(cap,"sse2"))){
+            moveImpl=moveZedsAVX2;
+            fallImpl=fallZedsAVX2;
+            simdname="avx2";
+        }else if(__builtin_cpu_supports("sse2")){
+            moveImpl=moveZedsSSE2;
+            fallImpl=fallZedsSSE2;
+            simdname="sse2";
+        }
+#endif
+    }
+
+    void moveZeds(float *px, float *pz, const float *dirx, const float *dirz,
+        const float *walk, int n, float s){
+        pthread_once(&picked,pickImpl);
+        moveImpl(px,pz,dirx,dirz,walk,n,s);
+    }
+
+    void fallZeds(float *py, float *vy, const float *walk, int n, float t, float g){
+        pthread_once(&picked,pickImpl);
+        fallImpl(py,vy,walk,n,t,g);
+    }
+
+    int segmentVsBoxes(const float *p1, const float *p2, const Boxes& b){
+        pthread_once(&picked,pickImpl);
+        return segmentImpl(p1,p2,b);
+    }
+
+    int obbVsBoxes(const OBB& a, const Boxes& b){
+        pthread_once(&picked,pickImpl);
+        return overlapImpl(a,b);
+    }
+
+    const char* simdName(){
+        pthread_once(&picked,pickImpl);
+        return simdname;
+    }
+
+}
@@ -0,0 +1,40 @@
+#ifndef H_SIMD
+#define H_SIMD
+
+#include "sim.h"
+
+//batched kernels over the zed arrays. the widest implementation the cpu
+//supports is picked on first use, all of them give bit identical results
+
+namespace Game{
+
+    //zed boxes gathered for one query
+    const int BOX_BATCH=64;
+    struct Boxes{
+        float px[BOX_BATCH],py[BOX_BATCH],pz[BOX_BATCH]; //centers
+        float c[BOX_BATCH],s[BOX_BATCH]; //x axis (c,0,-s), z axis (s,0,c)
+        float ex[BOX_BATCH],ey[BOX_BATCH],ez[BOX_BATCH];
+        int id[BOX_BATCH];
+        int n;
+    };
+
+    //p+=dir*walk*s. walk is 0 for zeds not on their feet, otherwise the
+    //number of steps the zed takes in one go (1 unless it is far from players)
+    void moveZeds(float *px, float *pz, const float *dirx, const float *dirz,
+        const float *walk, int n, float s);
+    //gravity over walk*t for walking zeds, clamped to the ground once they're below it
+    void fallZeds(float *py, float *vy, const float *walk, int n, float t, float g);
+
+    //index of the first box the segment p1-p2 passes through, -1 if none
+    int segmentVsBoxes(const float *p1, const float *p2, const Boxes& b);
+    //index of the first box overlapping a, -1 if none
+    int obbVsBoxes(const OBB& a, const Boxes& b);
+    //same tests one box at a time, the reference the batched ones must match
+    int segmentVsBoxesScalar(const float *p1, const float *p2, const Boxes& b);
+    int obbVsBoxesScalar(const OBB& a, const Boxes& b);
+
+    const char* simdName();
+
+}
+
+#endif
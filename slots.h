@@ -0,0 +1,84 @@
+#ifndef H_SLOTS
+#define H_SLOTS
+
+//o(1) slot allocation for the fixed size entity arrays. order holds every
+//slot, the first count are in use and the rest are free, and pos maps a slot
+//back to its place in order. so slots are handed out and released by swapping
+//at the boundary, any particular slot can be taken (clients are told which
+//zed ids are in use) and the live ones can be walked without scanning.
+//gen counts how often a slot was released, a handle made before that no
+//longer resolves
+
+namespace Game{
+
+    const int HANDLE_BITS=20; //slot index bits in a handle, the rest is generation
+    const unsigned int HANDLE_INDEX=(1u<<HANDLE_BITS)-1;
+
+    template<int N> struct Slots{
+        int order[N];
+        int pos[N];
+        unsigned int gen[N];
+        int count;
+
+        //everything free, lowest slots handed out first
+        void reset(){
+            count=0;
+            for(int i=0;i<N;i++){
+                order[i]=i;
+                pos[i]=i;
+                gen[i]=0;
+            }
+        }
+
+        void swap(const int a, const int b){
+            const int i=order[a];
+            const int j=order[b];
+            order[a]=j;
+            order[b]=i;
+            pos[j]=a;
+            pos[i]=b;
+        }
+
+        //-1 if full. the last slot released comes back first
+        int alloc(){
+            if(count==N)
+                return -1;
+            return order[count++];
+        }
+
+        //mark a particular slot used
+        void take(const int i){
+            if(pos[i]<count)
+                return;
+            swap(pos[i],count++);
+        }
+
+        //moves the last used slot into i's place, walk order backwards to
+        //release while walking it
+        void release(const int i){
+            if(pos[i]>=count)
+                return;
+            gen[i]++;
+            swap(pos[i],--count);
+        }
+
+        bool used(const int i) const {
+            return pos[i]<count;
+        }
+
+        unsigned int handle(const int i) const {
+            return gen[i]<<HANDLE_BITS | (unsigned int)i;
+        }
+
+        //slot a handle refers to, -1 if it has been released since
+        int get(const unsigned int h) const {
+            const int i=(int)(h&HANDLE_INDEX);
+            if(i>=N || !used(i) || handle(i)!=h)
+                return -1;
+            return i;
+        }
+    };
+
+}
+
+#endif